@@ -25,6 +25,7 @@
 #define _GNU_SOURCE
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
@@ -33,17 +34,32 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
 
 #if WITH_READLINE
 #include <readline/readline.h>
 #include <readline/history.h>
 #define HISTORY_FILE  ".config/afb-client.history"
 static void rlhexitcb();
+static int rl_getc_counted(FILE *stream);
 static char history_file_path[PATH_MAX];
 #endif
 
+#if WITH_IO_URING
+#include <liburing.h>
+#include <sys/eventfd.h>
+#define URING_ENTRIES 16
+#define URING_STAGE   65536
+#endif
+
 #include <systemd/sd-event.h>
 #include <json-c/json.h>
 #if !defined(JSON_C_TO_STRING_NOSLASHESCAPE)
@@ -63,6 +79,34 @@ static char history_file_path[PATH_MAX];
 #include <libafbcli/afb-ws-client.h>
 #include <libafbcli/afb-proto-ws.h>
 
+enum {
+	Alloc_Output,
+	Alloc_Pending,
+	Alloc_Input,
+	Alloc_Key,
+	Alloc_Request,
+	Alloc_Count
+};
+
+enum {
+	Setup_Connect,
+	Setup_First_Reply,
+	Setup_Cycle,
+	Setup_Count
+};
+
+enum {
+	Fanout_None,
+	Fanout_Broadcast,
+	Fanout_Shard
+};
+
+enum {
+	Policy_Block,
+	Policy_Drop_Events,
+	Policy_Drop_Oldest
+};
+
 enum {
 	Exit_Success       = 0,
 	Exit_Error         = 1,
@@ -77,6 +121,7 @@ enum {
 
 struct pending {
 	char *line;
+	struct producer *producer;
 	struct pending *next;
 };
 
@@ -88,6 +133,200 @@ struct buffer {
 	int file;
 };
 
+/* refresh period of --top, count of events shown and buckets of event counters */
+#define TOP_REFRESH_USEC 500000
+#define TOP_EVENTS 5
+#define EVCOUNT_BUCKETS 256
+#define SEQ_WINDOW 1024
+
+/* blocked output is polled for signals at this period */
+#define OUT_BLOCK_POLL_MS 100
+
+/* busy polling of sockets in microseconds and samples for the measurement floor */
+#define BUSY_POLL_USEC 50
+#define FLOOR_SAMPLES 1001
+
+/* a runner failing to send retries after a growing delay then stops */
+#define RUNNER_BACKOFF_USEC 10000
+#define RUNNER_MAX_FAILURES 10
+
+/* a reply is an outlier when slower than OUTLIER_FACTOR times the median */
+#define OUTLIER_FACTOR 2
+
+/* latency histogram: HISTO_SUB linear buckets per power of two */
+#define HISTO_SHIFT 4
+#define HISTO_SUB   (1 << HISTO_SHIFT)
+#define HISTO_COUNT ((64 - HISTO_SHIFT + 1) * HISTO_SUB)
+
+struct stats {
+	struct stats *next;
+	unsigned long sent;
+	unsigned long replied;
+	unsigned long errors;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint32_t histo[HISTO_COUNT];
+	char name[];
+};
+
+struct request {
+	char *key;
+	struct stats *stats;
+	struct runner *runner;
+	struct producer *producer;
+	struct endpoint *endpoint;
+	struct group *group;
+	uint64_t start;
+};
+
+struct endpoint {
+	char *uri;
+	struct afb_wsj1 *wsj1;
+	struct afb_proto_ws *pws;
+	struct stats *stats;
+	unsigned long outliers;
+	struct evcount **ids;
+};
+
+struct sample {
+	struct endpoint *endpoint;
+	uint64_t latency;
+};
+
+struct group {
+	struct runner *runner;
+	unsigned remaining;
+	unsigned count;
+	char *key;
+	struct sample samples[];
+};
+
+struct evcount {
+	struct evcount *next;
+	unsigned long count;
+	unsigned long last;
+	struct stats *stats;
+	int sequenced;
+	uint64_t seq_next;
+	unsigned long lost;
+	unsigned long gaps;
+	unsigned long reordered;
+	unsigned long duplicates;
+	unsigned long resets;
+	unsigned long ahead;
+	uint64_t missing[SEQ_WINDOW / 64];
+	char name[];
+};
+
+struct cost {
+	uint64_t time;
+	uint64_t user;
+	uint64_t sys;
+	long nvcsw;
+	long nivcsw;
+	long maxrss;
+	uint64_t rchar;
+	uint64_t wchar;
+	uint64_t input;
+	uint64_t output;
+	uint64_t uring_input;
+	uint64_t uring_output;
+	unsigned long requests;
+	unsigned long replies;
+	unsigned long events;
+	unsigned long allocs[Alloc_Count];
+};
+
+struct producer {
+	struct producer *next;
+	int fd;
+	unsigned refcount;
+	int num;
+	sd_event_source *src;
+	struct buffer *head;
+	struct buffer *tail;
+	size_t buffered;
+	char *input;
+	size_t length;
+	size_t size;
+	int eof;
+};
+
+struct step {
+	struct step *next;
+	char *api;
+	char *verb;
+	char *object;
+	unsigned repeat;
+	uint64_t think;
+	struct stats *stats;
+};
+
+struct scenario {
+	struct scenario *next;
+	struct step *steps;
+	unsigned weight;
+	unsigned long runs;
+	char name[];
+};
+
+struct alias {
+	double prob;
+	unsigned index;
+};
+
+struct phase {
+	const char *name;
+	struct stats *stats;
+	uint64_t start;
+	uint64_t stop;
+	uint64_t cpu;
+	uint64_t wire_sent;
+	uint64_t wire_received;
+	int wire_known;
+};
+
+enum part_kind {
+	Part_Text,
+	Part_Api,
+	Part_Verb,
+	Part_Args
+};
+
+struct part {
+	enum part_kind kind;
+	const char *text;
+	size_t length;
+};
+
+struct response {
+	struct response *next;
+	char *api;
+	char *verb;
+	char *body;
+	struct part *parts;
+	unsigned nparts;
+	int iserror;
+	uint64_t delay;
+};
+
+struct delayed {
+	struct response *response;
+	struct afb_wsj1_msg *msg;
+	char *verb;
+	char api[];
+};
+
+struct runner {
+	struct step *step;
+	unsigned remain;
+	uint16_t session;
+	struct endpoint *endpoint;
+	unsigned failures;
+	sd_event_source *timer;
+};
+
 /* declaration of functions */
 static void on_wsj1_hangup(void *closure, struct afb_wsj1 *wsj1);
 static void on_wsj1_call(void *closure, const char *api, const char *verb, struct afb_wsj1_msg *msg);
@@ -102,16 +341,55 @@ static void on_pws_event_unsubscribe(void *closure, void *request, uint16_t even
 static void on_pws_event_push(void *closure, uint16_t event_id, struct json_object *data);
 static void on_pws_event_broadcast(void *closure, const char *event_name, struct json_object *data, const afb_proto_ws_uuid_t uuid, uint8_t hop);
 
-static void emit_line(char *line);
+static void emit_line(char *line, struct producer *producer);
+static void process_input(ssize_t rc);
 static void process_line(char *line);
 static int on_stdin(sd_event_source *src, int fd, uint32_t revents, void *closure);
 
 static int onout(sd_event_source *src, int fd, uint32_t revents, void *closure);
 static int print(const char *fmt, ...);
 static int error(const char *fmt, ...);
+static int report(const char *fmt, ...);
+static uint64_t now_ns();
+static void oom();
+static void ensure_allocation(void *p);
+
+static int wsj1_emit(const char *api, const char *verb, const char *object, struct runner *runner, struct producer *producer);
+static int pws_call(const char *verb, const char *object, struct runner *runner, struct producer *producer);
 
-static void wsj1_emit(const char *api, const char *verb, const char *object);
-static void pws_call(const char *verb, const char *object);
+static int parse_duration(const char *text, uint64_t *usec);
+static size_t parse_size(const char *text);
+static void stats_report();
+static struct stats *stats_get(const char *name);
+static void scenario_load(const char *path);
+static void scenario_start(unsigned count);
+static void sessions_create();
+static void compare_load();
+static void responder_load(const char *path);
+static void listen_start(const char *spec);
+static void catch_signals();
+static int signal_pending();
+static void out_nonblock();
+#if WITH_IO_URING
+static int uring_setup();
+static void uring_read_enable(int enable);
+static void uring_submit();
+#endif
+static void compare_next_phase();
+static void setup_record(int phase, uint64_t start, uint64_t stop);
+static int fd_probe();
+static void busy_poll_sockets(int first);
+static void floor_measure();
+static void cost_start();
+static void top_start();
+static struct evcount *event_counted(const char *name);
+static struct evcount *event_counted_id(void *closure, uint16_t event_id);
+static void event_track_text(struct evcount *evcount, const char *text);
+static void event_track_json(struct evcount *evcount, struct json_object *object);
+static void events_report();
+static struct evcount *evcount_get(const char *name);
+static void churn_next();
+static void churn_schedule(uint64_t start);
 
 /* the callback interface for wsj1 */
 static struct afb_wsj1_itf wsj1_itf = {
@@ -148,16 +426,138 @@ static sd_event *loop;
 static sd_event_source *evsrc;
 static char *uuid;
 static char *wsmaxlen;
+static char *cpuarg;
 static size_t ws_max_length;
 static char *token;
 static uint16_t numuuid;
 static uint16_t numtoken;
+static unsigned nsessions;
+static char *sessions_file;
+static uint16_t *sessions_tokens;
+static unsigned sessions_next;
 static char *url;
 static int exitcode = 0;
 static struct pending *pendings_head = 0;
 static struct pending *pendings_tail = 0;
 static struct buffer *buffers_head = 0;
 static struct buffer *buffers_tail = 0;
+static char   inbuf[16384];
+static size_t inpos = 0;
+static size_t incount = 0;
+static char  *inprvline = NULL;
+static size_t inprvsize = 0;
+#if WITH_IO_URING
+static int use_uring;
+enum {
+	Uring_Poll = 1,
+	Uring_Read,
+	Uring_Write
+};
+static struct io_uring ring;
+static int uring;
+static int uring_input;
+static int uring_reading;
+static int uring_read_enabled;
+static int uring_queued;
+static int uring_exiting;
+static int uring_blocked;
+static int uring_read_deferred;
+static int uring_read_res;
+static int uring_efd = -1;
+static char uring_stage[URING_STAGE];
+static size_t uring_stage_length;
+static size_t uring_stage_offset;
+static int uring_stage_file;
+#endif
+static sd_event_source *outsrc;
+static size_t buffered_bytes;
+static size_t buffered_peak;
+static size_t out_max;
+static int out_policy = Policy_Block;
+static int out_flags[3];
+static unsigned long dropped_events;
+static uint64_t dropped_bytes;
+static int dostats;
+static uint64_t stats_origin;
+static struct stats *stats_head = 0;
+static struct stats *stats_tail = 0;
+static char *scenario_file;
+static struct scenario **scenarios;
+static struct alias *aliases;
+static unsigned scenario_count;
+static unsigned long runcount;
+static unsigned long runstarted;
+static unsigned runners_active;
+static int interrupted;
+static char *compare_spec;
+static char **compare_lines;
+static unsigned compare_count;
+static int compare_index = -1;
+static struct phase compare_phases[2];
+static struct stats *compare_stats;
+static uint64_t output_bytes;
+static char *responder_file;
+static struct response **responses;
+static unsigned responses_mask;
+static struct response *response_default;
+static unsigned long responder_replies;
+static char *listen_spec;
+static char *listen_path;
+static int listening;
+static struct producer *producers;
+static struct producer *print_to;
+static int top;
+static sd_event_source *top_timer;
+static struct stats *top_stats;
+static uint64_t top_origin;
+static uint64_t top_last;
+static unsigned long top_replies_last;
+static unsigned long top_suppressed;
+static struct evcount *evcounts[EVCOUNT_BUCKETS];
+static struct evcount **evcount_ids;
+static int evtrack;
+static char *event_time_path;
+static uint64_t event_time_unit = 1000000;
+static char *event_seq_path;
+static unsigned long pendings_count;
+static int docost;
+static uint64_t cost_interval;
+static sd_event_source *cost_timer;
+static struct cost cost_origin;
+static struct cost cost_last;
+static unsigned long allocs[Alloc_Count];
+static unsigned long requests_sent;
+static unsigned long replies_received;
+static unsigned long events_received;
+static uint64_t input_bytes;
+static uint64_t uring_input_bytes;
+static uint64_t uring_output_bytes;
+static int busypoll;
+static int busypoll_sockets;
+static int cpu = -1;
+static uint64_t floor_clock[2];
+static uint64_t floor_loop[2];
+static int floor_measured;
+static struct stats *setup_stats[Setup_Count];
+static uint64_t setup_connected;
+static unsigned churncount;
+static unsigned churncalls = 1;
+static double churnrate;
+static unsigned churn_started;
+static unsigned churn_failed;
+static unsigned churn_calls_left;
+static int churning;
+static int churn_closing;
+static uint64_t churn_origin;
+static uint64_t churn_start;
+static sd_event_source *churn_timer;
+static char **churn_args;
+static const char *churn_object;
+static int fanout;
+static struct endpoint *endpoints;
+static unsigned nendpoints;
+static unsigned endpoints_next;
+static char sep[] = " \t";
 
 /* print usage of the program */
 static void usage(int status, char *arg0)
@@ -170,16 +570,45 @@ static void usage(int status, char *arg0)
 	prt("\n"
 		"allowed options\n"
 		"  -b, --break         Break connection just after event/call has been emitted.\n"
+		"      --churn N       Run N cycles of connecting, calling and disconnecting\n"
+		"      --churn-calls K Count of calls of each churn cycle (default 1)\n"
+		"      --busy-poll     Spin the event loop instead of sleeping (lower latency)\n"
+		"      --compare SPEC  Replay input on uri (WS/HTTP) then on SPEC (WSAPI) and compare\n"
+		"      --cost          Report the CPU, memory, allocations and bytes used by afb-client\n"
+		"      --count COUNT   Count of scenarios to run (default: until interrupted)\n"
+		"      --cpu N         Pin the process on the CPU N\n"
 		"  -d, --direct        Direct api\n"
 		"  -e, --echo          Echo inputs\n"
+		"      --event-seq PATH  Detect lost and reordered events by their\n"
+		"                      sequence number at PATH (like info.seq) in event data\n"
+		"      --event-time PATH[:UNIT]  Measure the latency of events from their\n"
+		"                      timestamp at PATH, UNIT is s, ms (default), us or ns\n"
+		"      --fanout MODE   uri is a comma separated list of uris, MODE is\n"
+		"                      broadcast (send to all) or shard (spread on them)\n"
 		"  -h, --help          Display this help\n"
 		"  -H, --human         Display human readable JSON\n"
+#if WITH_IO_URING
+		"      --io-uring      Use io_uring for reading input and writing output\n"
+#endif
 		"  -k, --keep-running  Keep running until disconnect, even if input closed\n"
+		"      --listen SPEC   Serve requests of local clients connecting to SPEC (unix:PATH)\n"
+		"      --out-max SIZE  Maximum size of buffered output (suffixes k, M allowed)\n"
+		"      --out-policy POLICY  Policy when output exceeds --out-max:\n"
+		"                      block (default), drop-events (replies are\n"
+		"                      still buffered, unbounded) or drop-oldest\n"
 		"  -p, --pipe COUNT    Allow to pipe COUNT requests\n"
 		"  -q, --quiet         Less output\n"
 		"  -r, --raw           Raw output (default)\n"
+		"      --rate RATE     Churn at most RATE connections per second\n"
+		"      --report-interval DURATION  Report costs (see --cost) every DURATION\n"
+		"      --responder FILE Reply to calls of the binder using the table of FILE\n"
 		"  -s, --sync          Synchronous: wait for answers (like -p 1)\n"
+		"      --scenario FILE Run the weighted scenarios of FILE (implies --stats)\n"
+		"      --sessions N    Direct api: spread calls on N sessions (UUID is the prefix)\n"
+		"      --sessions-file FILE  Direct api: sessions are lines 'UUID [TOKEN]' of FILE\n"
+		"      --stats         Report latency statistics at exit\n"
 		"  -t, --token TOKEN   The token to use\n"
+		"      --top           Show a status panel instead of replies and events\n"
 		"  -u, --uuid UUID     The identifier of session to use\n"
 		"  -v, --version       Print the version and exits\n"
 		"  -w, --ws-maxlen VAL Set maximum length of websocket messages\n"
@@ -250,11 +679,108 @@ static const char *cmdarg(char *cmd)
 	return readfile(stdin);
 }
 
+/* connect the WSAPI interface of spec */
+static int connect_pws(const char *spec, void *closure)
+{
+	int first = busypoll ? fd_probe() : -1;
+	uint64_t start = now_ns(), connected;
+
+	pws = afb_ws_client_connect_api(loop, spec, &pws_itf, closure);
+	if (pws == NULL) {
+		error("connection to %s failed: %m\n", spec);
+		return -1;
+	}
+	connected = now_ns();
+	if (busypoll)
+		busy_poll_sockets(first);
+	setup_record(Setup_Connect, start, connected);
+	if (wsmaxlen)
+		afb_proto_ws_set_max_length(pws, ws_max_length);
+	afb_proto_ws_on_hangup(pws, on_pws_hangup);
+	if (nsessions || sessions_file)
+		sessions_create();
+	else if (uuid) {
+		numuuid = 1;
+		afb_proto_ws_client_session_create(pws, numuuid, uuid);
+	}
+	if (token && !nsessions) {
+		numtoken = 1;
+		afb_proto_ws_client_token_create(pws, numtoken, token);
+	}
+	/* no reply comes for sessions and tokens: their creation is timed by the first reply */
+	setup_connected = connected;
+	return 0;
+}
+
+/* connect the WS/HTTP interface of uri */
+static int connect_wsj1(const char *uri, void *closure)
+{
+	int rc, first = busypoll ? fd_probe() : -1;
+	uint64_t start;
+
+	free(url);
+	rc = asprintf(&url, "%s%s%s%s%s%s%s",
+		uri,
+		uuid || token ? "?" : "",
+		uuid ? "uuid=" : "",
+		uuid ?: "",
+		uuid && token ? "&" : "",
+		token ? "token=" : "",
+		token ?: ""
+	);
+	if (rc < 0)
+		oom();
+	start = now_ns();
+	wsj1 = afb_ws_client_connect_wsj1(loop, url, &wsj1_itf, closure);
+	if (wsj1 == NULL) {
+		error("connection to %s failed: %m\n", uri);
+		return -1;
+	}
+	setup_connected = now_ns();
+	setup_record(Setup_Connect, start, setup_connected);
+	if (busypoll)
+		busy_poll_sockets(first);
+	if (wsmaxlen)
+		afb_wsj1_set_max_length(wsj1, ws_max_length);
+	return 0;
+}
+
+/* connect each endpoint of the comma separated list of uris */
+static int connect_endpoints(const char *uris)
+{
+	char *list, *uri, *save;
+	unsigned count;
+
+	list = strdup(uris);
+	ensure_allocation(list);
+	for (count = 1, uri = list ; (uri = strchr(uri, ',')) ; uri++)
+		count++;
+	endpoints = calloc(count, sizeof *endpoints);
+	ensure_allocation(endpoints);
+	for (uri = strtok_r(list, ",", &save) ; uri ; uri = strtok_r(NULL, ",", &save)) {
+		struct endpoint *endpoint = &endpoints[nendpoints++];
+		endpoint->uri = uri;
+		if (direct ? connect_pws(uri, endpoint) : connect_wsj1(uri, endpoint))
+			return -1;
+		endpoint->pws = pws;
+		endpoint->wsj1 = wsj1;
+		if (asprintf(&uri, "@%s", endpoint->uri) < 0)
+			oom();
+		endpoint->stats = stats_get(uri);
+		free(uri);
+	}
+	if (!nendpoints) {
+		error("no endpoint in %s\n", uris);
+		return -1;
+	}
+	return 0;
+}
+
 /* entry function */
 int main(int ac, char **av, char **env)
 {
 	int rc;
-	char *a0, *an;
+	char *a0, *an, *unit;
 
 	/* get the program name */
 	a0 = av[0];
@@ -276,6 +802,50 @@ int main(int ac, char **av, char **env)
 			else if (!strcmp(an, "--break")) /* request to break connection */
 				breakcon = 1;
 
+			else if (!strcmp(an, "--busy-poll")) /* spin the loop */
+				busypoll = 1;
+
+			else if (!strcmp(an, "--cpu") && av[2]) { /* cpu to pin */
+				cpuarg = av[2];
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--churn") && av[2] && atol(av[2]) > 0) { /* connection churn */
+				churncount = (unsigned)atol(av[2]);
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--churn-calls") && av[2] && atol(av[2]) > 0) { /* calls per churn */
+				churncalls = (unsigned)atol(av[2]);
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--compare") && av[2]) { /* WSAPI to compare with */
+				compare_spec = av[2];
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--cost")) /* self profiling */
+				docost = 1;
+
+			else if (!strcmp(an, "--top")) /* status panel */
+				top = 1;
+
+			else if (!strcmp(an, "--count") && av[2] && atol(av[2]) > 0) { /* count of scenarios */
+				runcount = (unsigned long)atol(av[2]);
+				av++;
+				ac--;
+			}
+#if WITH_IO_URING
+			else if (!strcmp(an, "--io-uring")) /* request io_uring */
+				use_uring = 1;
+#endif
+
+			else if (!strcmp(an, "--listen") && av[2]) { /* daemon mode */
+				listen_spec = av[2];
+				av++;
+				ac--;
+			}
 			else if (!strcmp(an, "--keep-running")) /* request to break connection */
 				keeprun = 1;
 
@@ -285,6 +855,69 @@ int main(int ac, char **av, char **env)
 			else if (!strcmp(an, "--echo")) /* request to echo inputs */
 				echo = 1;
 
+			else if (!strcmp(an, "--event-seq") && av[2]) { /* sequence of events */
+				event_seq_path = av[2];
+				evtrack = 1;
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--event-time") && av[2]) { /* timestamp of events */
+				event_time_path = av[2];
+				unit = strrchr(event_time_path, ':');
+				if (unit) {
+					if (!strcmp(unit, ":s"))
+						event_time_unit = 1000000000;
+					else if (!strcmp(unit, ":ms"))
+						event_time_unit = 1000000;
+					else if (!strcmp(unit, ":us"))
+						event_time_unit = 1000;
+					else if (!strcmp(unit, ":ns"))
+						event_time_unit = 1;
+					else {
+						error("bad unit for option --event-time\n");
+						return 1;
+					}
+					*unit = 0;
+				}
+				evtrack = 1;
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--fanout") && av[2]) { /* multiple endpoints */
+				if (!strcmp(av[2], "broadcast"))
+					fanout = Fanout_Broadcast;
+				else if (!strcmp(av[2], "shard"))
+					fanout = Fanout_Shard;
+				else {
+					error("bad value for option --fanout\n");
+					return 1;
+				}
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--out-max") && av[2]) { /* maximum of buffered output */
+				out_max = parse_size(av[2]);
+				if (!out_max) {
+					error("bad value for option --out-max\n");
+					return 1;
+				}
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--out-policy") && av[2]) { /* policy of buffered output */
+				if (!strcmp(av[2], "block"))
+					out_policy = Policy_Block;
+				else if (!strcmp(av[2], "drop-events"))
+					out_policy = Policy_Drop_Events;
+				else if (!strcmp(av[2], "drop-oldest"))
+					out_policy = Policy_Drop_Oldest;
+				else {
+					error("bad value for option --out-policy\n");
+					return 1;
+				}
+				av++;
+				ac--;
+			}
 			else if (!strcmp(an, "--pipe") && av[2] && atoi(av[2]) > 0) {
 				synchro = atoi(av[2]);
 				av++;
@@ -293,6 +926,43 @@ int main(int ac, char **av, char **env)
 			else if (!strcmp(an, "--quiet")) /* request less output */
 				quiet = 1;
 
+			else if (!strcmp(an, "--report-interval") && av[2]) { /* periodic reports */
+				if (parse_duration(av[2], &cost_interval) || !cost_interval) {
+					error("bad value for option --report-interval\n");
+					return 1;
+				}
+				docost = 1;
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--rate") && av[2] && atof(av[2]) > 0) { /* churn rate */
+				churnrate = atof(av[2]);
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--responder") && av[2]) { /* table of replies */
+				responder_file = av[2];
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--scenario") && av[2]) { /* scenario file */
+				scenario_file = av[2];
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--sessions") && av[2] && atoi(av[2]) > 0) { /* count of sessions */
+				nsessions = (unsigned)atoi(av[2]);
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--sessions-file") && av[2]) { /* file of sessions */
+				sessions_file = av[2];
+				av++;
+				ac--;
+			}
+			else if (!strcmp(an, "--stats")) /* request statistics */
+				dostats = 1;
+
 			else if (!strcmp(an, "--token") && av[2]) { /* token to use */
 				token = av[2];
 				av++;
@@ -340,6 +1010,16 @@ int main(int ac, char **av, char **env)
 		ac--;
 	}
 
+	/* get the cpu */
+	if (cpuarg) {
+		long n = strtol(cpuarg, &an, 10);
+		if (an == cpuarg || an[0] != 0 || n < 0 || n >= CPU_SETSIZE) {
+			error("bad value for option --cpu\n");
+			return 1;
+		}
+		cpu = (int)n;
+	}
+
 	/* get maxlen */
 	if (wsmaxlen) {
 		long wml = strtol(wsmaxlen, &wsmaxlen, 10);
@@ -359,6 +1039,10 @@ int main(int ac, char **av, char **env)
 		error("missing uri\n");
 		return 1;
 	}
+	else if (scenario_file && ac != 2) {
+		error("no request allowed in arguments with --scenario\n");
+		return 1;
+	}
 	else if (ac == 2)
 		;/* do nothing, it is okay */
 	else if (direct && (ac != 3 && ac != 4)) {
@@ -373,6 +1057,48 @@ int main(int ac, char **av, char **env)
 		return 1;
 	}
 
+	/* check comparison */
+	if (responder_file && direct) {
+		error("option --responder is only for WS/HTTP and excludes --direct\n");
+		return 1;
+	}
+	if (compare_spec && (direct || scenario_file || fanout || ac != 2)) {
+		error("option --compare requires requests from input and excludes --direct, --fanout and --scenario\n");
+		return 1;
+	}
+
+	/* check daemon mode */
+	if (listen_spec && (compare_spec || scenario_file || ac != 2)) {
+		error("option --listen excludes requests in arguments, --compare and --scenario\n");
+		return 1;
+	}
+
+	/* check sessions */
+	if ((nsessions || sessions_file) && !direct) {
+		error("options --sessions and --sessions-file require --direct\n");
+		return 1;
+	}
+	if (nsessions > UINT16_MAX) {
+		error("value of --sessions is too big (maxi is %d)\n", UINT16_MAX);
+		return 1;
+	}
+
+	/* load the scenarios */
+	if (scenario_file) {
+		scenario_load(scenario_file);
+		dostats = 1;
+	}
+	if (fanout || evtrack)
+		dostats = 1;
+
+	/* load the table of replies */
+	if (responder_file)
+		responder_load(responder_file);
+
+	/* load the workload to compare */
+	if (compare_spec)
+		compare_load();
+
 	/* set raw by default */
 	setvbuf(stdout, NULL, _IOLBF, 0);
 
@@ -383,45 +1109,99 @@ int main(int ac, char **av, char **env)
 		return 1;
 	}
 
-	/* connect the websocket wsj1 to the uri given by the first argument */
-	if (direct) {
-		pws = afb_ws_client_connect_api(loop, av[1], &pws_itf, NULL);
-		if (pws == NULL) {
-			error("connection to %s failed: %m\n", av[1]);
-			return Exit_Cant_Connect;
-		}
-		if (wsmaxlen)
-			afb_proto_ws_set_max_length(pws, ws_max_length);
-		afb_proto_ws_on_hangup(pws, on_pws_hangup);
-		if (uuid) {
-			numuuid = 1;
-			afb_proto_ws_client_session_create(pws, numuuid, uuid);
-		}
-		if (token) {
-			numtoken = 1;
-			afb_proto_ws_client_token_create(pws, numtoken, token);
+#if WITH_IO_URING
+	/* setup io_uring, falling back to read/write when unavailable */
+	if (use_uring && uring_setup() < 0 && !quiet)
+		error("io_uring unavailable, using read and write\n");
+#endif
+
+	/* a slow reader of the output must not block the writes */
+	if (out_max)
+		out_nonblock();
+
+	/* pin the process on the requested CPU */
+	if (cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof set, &set) < 0) {
+			error("can't pin to CPU %d: %m\n", cpu);
+			return 1;
 		}
-	} else {
-		rc = asprintf(&url, "%s%s%s%s%s%s%s",
-			av[1],
-			uuid || token ? "?" : "",
-			uuid ? "uuid=" : "",
-			uuid ?: "",
-			uuid && token ? "&" : "",
-			token ? "token=" : "",
-			token ?: ""
-		);
-		wsj1 = afb_ws_client_connect_wsj1(loop, url, &wsj1_itf, NULL);
-		if (wsj1 == NULL) {
-			error("connection to %s failed: %m\n", av[1]);
-			return Exit_Cant_Connect;
-		}
-		if (wsmaxlen)
-			afb_wsj1_set_max_length(wsj1, ws_max_length);
 	}
 
+	/* measure the floor of latencies before any connection */
+	if (busypoll || dostats || churncount)
+		floor_measure();
+	if (busypoll && !dostats && !churncount && !quiet)
+		report("FLOOR clock %.0f ns (p50 %.0f ns), loop iteration %.0f ns (p50 %.0f ns)\n",
+			(double)floor_clock[0], (double)floor_clock[1],
+			(double)floor_loop[0], (double)floor_loop[1]);
+
+	if (churncount && (compare_spec || scenario_file || listen_spec || fanout || ac < (direct ? 3 : 4))) {
+		error("option --churn requires a request as argument and excludes --compare, --fanout, --listen and --scenario\n");
+		return 1;
+	}
+	if (churncount)
+		dostats = 1;
+
+	/* connect the websocket wsj1 to the uri given by the first argument */
+	if (churncount)
+		; /* connections are made by the churn cycles */
+	else if (fanout ? connect_endpoints(av[1]) : direct ? connect_pws(av[1], NULL) : connect_wsj1(av[1], NULL))
+		return Exit_Cant_Connect;
+
+	/* connect the WSAPI to compare with */
+	if (compare_spec && connect_pws(compare_spec, NULL))
+		return Exit_Cant_Connect;
+
+	/* prepare reporting of statistics */
+	if (dostats) {
+		stats_origin = now_ns();
+		atexit(stats_report);
+	}
+	if (docost)
+		cost_start();
+	if (top)
+		top_start();
+
 	/* test the behaviour */
-	if (ac == 2) {
+	if (churncount) {
+		/* the request is repeated on new connections */
+		usein = 0;
+		churning = 1;
+		churn_args = av;
+		churn_object = cmdarg(av[direct ? 3 : 4]);
+		churn_origin = now_ns();
+		catch_signals();
+		churn_schedule(churn_origin);
+	}
+	else if (listen_spec) {
+		/* the requests are received from local clients */
+		usein = 0;
+		listen_start(listen_spec);
+	}
+	else if (compare_spec) {
+		/* the requests are replayed by phases */
+		usein = 0;
+		synchro = synchro ?: 1;
+		compare_next_phase();
+	}
+	else if (scenario_file) {
+		/* the requests are defined by the scenarios */
+		usein = 0;
+		scenario_start(synchro ?: 1);
+	}
+#if WITH_IO_URING
+	else if (ac == 2 && uring && !isatty(0)) {
+		/* get requests from stdin through io_uring */
+		usein = 1;
+		uring_input = 1;
+		uring_read_enable(1);
+		uring_submit();
+	}
+#endif
+	else if (ac == 2) {
 		/* get requests from stdin */
 		usein = 1;
 		ontty = isatty(0);
@@ -430,6 +1210,7 @@ int main(int ac, char **av, char **env)
 			evsrc = NULL;
 #if WITH_READLINE
 		else if (ontty) {
+			rl_getc_function = rl_getc_counted;
 			rl_callback_handler_install(0, process_line);
 			snprintf(history_file_path, sizeof history_file_path, "%s/%s",
 							getenv("HOME")?:"", HISTORY_FILE);
@@ -442,14 +1223,14 @@ int main(int ac, char **av, char **env)
 		/* the request is defined by the arguments */
 		usein = 0;
 		if (direct)
-			pws_call(av[2], cmdarg(av[3]));
+			pws_call(av[2], cmdarg(av[3]), NULL, NULL);
 		else
-			wsj1_emit(av[2], av[3], cmdarg(av[4]));
+			wsj1_emit(av[2], av[3], cmdarg(av[4]), NULL, NULL);
 	}
 
 	/* loop until end */
-	while (usein || keeprun || callcount) {
-		sd_event_run(loop, 30000000);
+	while (!interrupted && (usein || keeprun || callcount || runners_active || listening || churning)) {
+		sd_event_run(loop, busypoll ? 0 : 30000000);
 	}
 	return exitcode;
 }
@@ -460,6 +1241,16 @@ static void rlhexitcb()
 	rl_deprep_terminal();
 	write_history(history_file_path);
 }
+
+/* read a typed character, counting it as input */
+static int rl_getc_counted(FILE *stream)
+{
+	int c = rl_getc(stream);
+
+	if (c != EOF)
+		input_bytes++;
+	return c;
+}
 #endif
 
 /* exit when out of memory */
@@ -489,134 +1280,2601 @@ static void ensure_allocation(void *p)
 		oom();
 }
 
-/* get a buffer line */
-static void flush_buffers()
+#if WITH_IO_URING
+/* get a submission entry, submitting queued ones if needed */
+static struct io_uring_sqe *uring_sqe(uint64_t kind)
 {
-	ssize_t rc;
-	struct buffer *buffer;
-	sd_event_source *src;
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
 
-	while((buffer = buffers_head)) {
-		rc = write(buffer->file, &buffer->value[buffer->offset], buffer->length - buffer->offset);
-		if (rc < 0) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK) {
-				if (sd_event_add_io(loop, &src, buffer->file, EPOLLOUT, onout, NULL) < 0)
-					fatal();
-				break;
-			}
-			if (errno != EINTR) {
-				fatal();
-			}
-		}
-		else {
-			buffer->offset += (size_t)rc;
-			if (buffer->offset == buffer->length) {
-				buffers_head = buffer->next;
-				free(buffer->value);
-				free(buffer);
-			}
-		}
+	if (sqe == NULL) {
+		io_uring_submit(&ring);
+		sqe = io_uring_get_sqe(&ring);
+		if (sqe == NULL)
+			fatal();
 	}
+	io_uring_sqe_set_data64(sqe, kind);
+	uring_queued = 1;
+	return sqe;
 }
 
-static int onout(sd_event_source *src, int fd, uint32_t revents, void *closure)
+/* queue a poll of fd for events, linked to the next entry */
+static void uring_queue_poll(int fd, unsigned events)
 {
-	sd_event_source_unref(src);
-	flush_buffers();
-	return 0;
+	struct io_uring_sqe *sqe = uring_sqe(Uring_Poll);
+
+	io_uring_prep_poll_add(sqe, fd, events);
+	sqe->flags |= IOSQE_IO_LINK;
 }
 
-static int out(int file, const char *fmt, va_list ap)
+/* queue a read of stdin in the input buffer, after polling if wait */
+static void uring_queue_read(int wait)
 {
-	int rc;
-	struct buffer *buffer = malloc(sizeof *buffer);
-	buffer->file = file;
-	rc = vasprintf(&buffer->value, fmt, ap);
-	if (rc < 0) { oom(); return rc; }
-	if (rc == 0) {
-		free(buffer);
-	}
-	else {
-		buffer->length = (unsigned)rc;
-		buffer->offset = 0;
-		buffer->next = 0;
-		*(!buffers_head ? &buffers_head : &buffers_tail->next) = buffer;
-		buffers_tail = buffer;
-	}
-	flush_buffers();
-	return 0;
+	struct io_uring_sqe *sqe;
+
+	if (wait)
+		uring_queue_poll(0, POLLIN);
+	sqe = uring_sqe(Uring_Read);
+	io_uring_prep_read_fixed(sqe, 0, inbuf + incount, (unsigned)(sizeof inbuf - incount), (uint64_t)-1, 0);
+	uring_reading = 1;
 }
 
-static int print(const char *fmt, ...)
+/* queue the write of the staged output, after polling if wait */
+static void uring_queue_write(int wait)
 {
-	int r;
-	va_list ap;
+	struct io_uring_sqe *sqe;
+
+	if (wait)
+		uring_queue_poll(uring_stage_file, POLLOUT);
+	sqe = uring_sqe(Uring_Write);
+	io_uring_prep_write_fixed(sqe, uring_stage_file, uring_stage + uring_stage_offset,
+		(unsigned)(uring_stage_length - uring_stage_offset), (uint64_t)-1, 1);
+}
+
+/* enable or disable reading of stdin */
+static void uring_read_enable(int enable)
+{
+	uring_read_enabled = enable;
+	if (enable && usein && !uring_reading && sizeof inbuf > incount)
+		uring_queue_read(0);
+}
+
+/* stage the buffered output of one file and write it */
+static void uring_flush()
+{
+	struct buffer *buffer;
+	size_t length;
+
+	if (uring_stage_length)
+		return; /* a write is in progress */
+
+	while ((buffer = buffers_head)
+	    && (!uring_stage_length || buffer->file == uring_stage_file)
+	    && uring_stage_length < sizeof uring_stage) {
+		uring_stage_file = buffer->file;
+		length = buffer->length - buffer->offset;
+		if (length > sizeof uring_stage - uring_stage_length)
+			length = sizeof uring_stage - uring_stage_length;
+		memcpy(&uring_stage[uring_stage_length], &buffer->value[buffer->offset], length);
+		uring_stage_length += length;
+		buffer->offset += length;
+		if (buffer->offset == buffer->length) {
+			buffers_head = buffer->next;
+			free(buffer->value);
+			free(buffer);
+		}
+	}
+	if (uring_stage_length) {
+		uring_stage_offset = 0;
+		uring_queue_write(0);
+	}
+}
+
+/* process a completion */
+static void uring_complete(uint64_t kind, int res)
+{
+	switch (kind) {
+	case Uring_Read:
+		if (uring_exiting) {
+			uring_reading = 0;
+			break;
+		}
+		if (uring_blocked) {
+			/* the input is not processed while the output blocks */
+			uring_read_deferred = 1;
+			uring_read_res = res;
+			break;
+		}
+		if (res == -EAGAIN || res == -ECANCELED) {
+			uring_queue_read(1);
+			break;
+		}
+		if (res == -EINTR)
+			res = 0;
+		if (res < 0)
+			errno = -res;
+		else
+			uring_input_bytes += (uint64_t)res;
+		/* no read is queued while processing moves the input buffer */
+		process_input(res < 0 ? -1 : res);
+		uring_reading = 0;
+		uring_read_enable(uring_read_enabled);
+		break;
+	case Uring_Write:
+		if (res == -EAGAIN || res == -ECANCELED || res == -EINTR) {
+			uring_queue_write(res != -EINTR);
+			break;
+		}
+		if (res < 0) {
+			if (!uring_exiting)
+				fatal();
+			uring_stage_length = uring_stage_offset = 0;
+			buffers_head = NULL;
+			break;
+		}
+		uring_output_bytes += (uint64_t)res;
+		buffered_bytes -= (size_t)res;
+		uring_stage_offset += (size_t)res;
+		if (uring_stage_offset < uring_stage_length)
+			uring_queue_write(0);
+		else {
+			uring_stage_length = uring_stage_offset = 0;
+			uring_flush();
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/* process the available completions */
+static void uring_process()
+{
+	struct io_uring_cqe *cqe;
+	uint64_t kind;
+	int res;
+
+	while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+		kind = io_uring_cqe_get_data64(cqe);
+		res = cqe->res;
+		io_uring_cqe_seen(&ring, cqe);
+		uring_complete(kind, res);
+	}
+}
+
+/* submit the queued entries */
+static void uring_submit()
+{
+	if (uring_queued) {
+		uring_queued = 0;
+		io_uring_submit(&ring);
+	}
+}
+
+/* submit and wait for at least one completion */
+static void uring_wait()
+{
+	struct io_uring_cqe *cqe;
+	struct __kernel_timespec ts = { .tv_sec = 0, .tv_nsec = OUT_BLOCK_POLL_MS * 1000000LL };
+	int rc;
+
+	uring_queued = 0;
+	rc = io_uring_submit(&ring);
+	if (rc >= 0)
+		rc = io_uring_wait_cqe_timeout(&ring, &cqe, &ts);
+	if (rc < 0 && rc != -EINTR && rc != -ETIME) {
+		if (!uring_exiting)
+			fatal();
+		uring_stage_length = 0;
+		buffers_head = NULL;
+		return;
+	}
+	if (io_uring_peek_cqe(&ring, &cqe) == 0)
+		uring_process();
+}
+
+/* called when completions are signaled on the eventfd */
+static int on_uring(sd_event_source *src, int fd, uint32_t revents, void *closure)
+{
+	uint64_t value;
+
+	if (read(fd, &value, sizeof value) > 0)
+		input_bytes += sizeof value;
+	uring_process();
+	uring_submit();
+	return 0;
+}
+
+/* called after each dispatch of the loop: batch the submissions */
+static int on_uring_post(sd_event_source *src, void *closure)
+{
+	if (uring_read_deferred && !uring_blocked) {
+		uring_read_deferred = 0;
+		uring_complete(Uring_Read, uring_read_res);
+	}
+	uring_submit();
+	return 0;
+}
+
+/* at exit, write the remaining output */
+static void uring_exit()
+{
+	uring_exiting = 1;
+	while ((buffers_head || uring_stage_length) && !signal_pending())
+		uring_wait();
+	io_uring_queue_exit(&ring);
+}
+
+/* setup io_uring, returns 0 on success or -1 when unavailable */
+static int uring_setup()
+{
+	struct iovec iovs[2];
+
+	if (io_uring_queue_init(URING_ENTRIES, &ring, 0) < 0)
+		return -1;
+	iovs[0].iov_base = inbuf;
+	iovs[0].iov_len = sizeof inbuf;
+	iovs[1].iov_base = uring_stage;
+	iovs[1].iov_len = sizeof uring_stage;
+	uring_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (uring_efd < 0
+	 || io_uring_register_buffers(&ring, iovs, 2) < 0
+	 || io_uring_register_eventfd(&ring, uring_efd) < 0
+	 || sd_event_add_io(loop, NULL, uring_efd, EPOLLIN, on_uring, NULL) < 0
+	 || sd_event_add_post(loop, NULL, on_uring_post, NULL) < 0) {
+		if (uring_efd >= 0)
+			close(uring_efd);
+		io_uring_queue_exit(&ring);
+		return -1;
+	}
+	uring = 1;
+	atexit(uring_exit);
+	return 0;
+}
+#endif
+
+/* get a buffer line */
+static void flush_buffers()
+{
+	ssize_t rc;
+	struct buffer *buffer;
+
+#if WITH_IO_URING
+	if (uring) {
+		uring_flush();
+		return;
+	}
+#endif
+	while((buffer = buffers_head)) {
+		rc = write(buffer->file, &buffer->value[buffer->offset], buffer->length - buffer->offset);
+		if (rc < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				if (!outsrc && sd_event_add_io(loop, &outsrc, buffer->file, EPOLLOUT, onout, NULL) < 0)
+					fatal();
+				break;
+			}
+			if (errno != EINTR) {
+				fatal();
+			}
+		}
+		else {
+			output_bytes += (uint64_t)rc;
+			buffered_bytes -= (size_t)rc;
+			buffer->offset += (size_t)rc;
+			if (buffer->offset == buffer->length) {
+				buffers_head = buffer->next;
+				free(buffer->value);
+				free(buffer);
+			}
+		}
+	}
+}
+
+static int onout(sd_event_source *src, int fd, uint32_t revents, void *closure)
+{
+	sd_event_source_unref(src);
+	outsrc = NULL;
+	flush_buffers();
+	return 0;
+}
+
+/* restore the modes of stdout and stderr and write what remains */
+static void out_exit()
+{
+	int fd;
+
+	for (fd = 1 ; fd <= 2 ; fd++)
+		if (out_flags[fd] >= 0)
+			fcntl(fd, F_SETFL, out_flags[fd]);
+	flush_buffers();
+}
+
+/* make writes of stdout and stderr non-blocking, restored at exit */
+static void out_nonblock()
+{
+	int fd;
+
+#if WITH_IO_URING
+	/* io_uring waits itself for the readers */
+	if (uring)
+		return;
+#endif
+	/* both modes are read first as stdout and stderr are often the same file */
+	for (fd = 1 ; fd <= 2 ; fd++)
+		out_flags[fd] = fcntl(fd, F_GETFL);
+	for (fd = 1 ; fd <= 2 ; fd++)
+		if (out_flags[fd] >= 0)
+			fcntl(fd, F_SETFL, out_flags[fd] | O_NONBLOCK);
+	atexit(out_exit);
+}
+
+/* wait until buffered output fits the maximum or a signal comes */
+static void out_block()
+{
+	struct pollfd pfd;
+
+#if WITH_IO_URING
+	if (uring) {
+		uring_blocked = 1;
+		while ((buffers_head || uring_stage_length) && buffered_bytes > out_max && !signal_pending())
+			uring_wait();
+		uring_blocked = 0;
+		return;
+	}
+#endif
+	while (buffers_head && buffered_bytes > out_max && !signal_pending()) {
+		pfd.fd = buffers_head->file;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, OUT_BLOCK_POLL_MS) < 0 && errno != EINTR)
+			fatal();
+		flush_buffers();
+	}
+}
+
+/* discard the oldest buffered output until it fits the maximum */
+static void out_drop_oldest()
+{
+	struct buffer *buffer, **prv;
+
+	/* the head buffer is kept when partly written */
+	prv = buffers_head && buffers_head->offset ? &buffers_head->next : &buffers_head;
+	while ((buffer = *prv) && buffered_bytes > out_max) {
+		*prv = buffer->next;
+		if (buffers_tail == buffer)
+			buffers_tail = prv == &buffers_head ? NULL : buffers_head;
+		buffered_bytes -= buffer->length;
+		dropped_bytes += buffer->length;
+		free(buffer->value);
+		free(buffer);
+	}
+}
+
+/* check if printing of events is to be skipped, counting it */
+static int out_drop_event()
+{
+	if (out_policy != Policy_Drop_Events || !out_max || buffered_bytes <= out_max)
+		return 0;
+	dropped_events++;
+	return 1;
+}
+
+static int out(int file, const char *fmt, va_list ap)
+{
+	int rc;
+	struct buffer *buffer = malloc(sizeof *buffer);
+	ensure_allocation(buffer);
+	allocs[Alloc_Output] += 2;
+	buffer->file = file;
+	rc = vasprintf(&buffer->value, fmt, ap);
+	if (rc < 0) { oom(); return rc; }
+	if (rc == 0) {
+		free(buffer);
+	}
+	else {
+		buffer->length = (unsigned)rc;
+		buffer->offset = 0;
+		buffer->next = 0;
+		*(!buffers_head ? &buffers_head : &buffers_tail->next) = buffer;
+		buffers_tail = buffer;
+		buffered_bytes += buffer->length;
+		if (buffered_bytes > buffered_peak)
+			buffered_peak = buffered_bytes;
+	}
+	flush_buffers();
+	if (out_max && buffered_bytes > out_max) {
+		if (out_policy == Policy_Block)
+			out_block();
+		else if (out_policy == Policy_Drop_Oldest)
+			out_drop_oldest();
+	}
+	return 0;
+}
+
+static int producer_out(struct producer *producer, const char *fmt, va_list ap);
+
+static int print(const char *fmt, ...)
+{
+	int r;
+	va_list ap;
+	va_start(ap, fmt);
+	r = print_to ? producer_out(print_to, fmt, ap) : out(1, fmt, ap);
+	va_end(ap);
+	return r;
+}
+
+static int error(const char *fmt, ...)
+{
+	int r;
+	va_list ap;
+	va_start(ap, fmt);
+	r = print_to ? producer_out(print_to, fmt, ap) : out(2, fmt, ap);
+	va_end(ap);
+	return r;
+}
+
+/* unlike error, always reports on stderr, even while serving a local client */
+static int report(const char *fmt, ...)
+{
+	int r;
+	va_list ap;
 	va_start(ap, fmt);
-	r = out(1, fmt, ap);
+	r = out(2, fmt, ap);
 	va_end(ap);
 	return r;
 }
 
-static int error(const char *fmt, ...)
+static void producer_unref(struct producer *producer);
+static void producer_close(struct producer *producer);
+static void producers_events();
+
+/* add a pending line */
+static void pendings_add(char *line, struct producer *producer)
+{
+	struct pending *pending = malloc(sizeof *pending);
+	ensure_allocation(pending);
+	allocs[Alloc_Pending]++;
+	pending->line = line;
+	pending->producer = producer;
+	if (producer)
+		producer->refcount++;
+	pending->next = 0;
+	*(!pendings_head ? &pendings_head : &pendings_tail->next) = pending;
+	pendings_tail = pending;
+	pendings_count++;
+}
+
+/* get a pending line and its producer */
+static char *pendings_get(struct producer **producer)
+{
+	struct pending *pending = pendings_head;
+	char *result = pending->line;
+	*producer = pending->producer;
+	pendings_head = pending->next;
+	pendings_count--;
+	free(pending);
+	return result;
+}
+
+/* emit the pending lines allowed by the window */
+static void emit_pendings()
+{
+	char *line;
+	struct producer *producer;
+
+	while (synchro && callcount < synchro && pendings_head) {
+		line = pendings_get(&producer);
+		print_to = producer;
+		emit_line(line, producer);
+		print_to = NULL;
+		free(line);
+		if (producer)
+			producer_unref(producer);
+	}
+}
+
+/* decrement the count of calls */
+static void dec_callcount()
+{
+	callcount--;
+	emit_pendings();
+
+	if (synchro && callcount < synchro && evsrc)
+		sd_event_source_set_io_events(evsrc, EPOLLIN);
+	if (synchro && callcount < synchro && producers)
+		producers_events();
+#if WITH_IO_URING
+	if (synchro && callcount < synchro && uring_input)
+		uring_read_enable(1);
+#endif
+
+	if (compare_index >= 0 && !callcount && !pendings_head)
+		compare_next_phase();
+	if (churning && !callcount)
+		churn_next();
+}
+
+/* increment the count of calls */
+static void inc_callcount()
+{
+	callcount++;
+	if (synchro && callcount >= synchro && evsrc)
+		sd_event_source_set_io_events(evsrc, 0);
+	if (synchro && callcount >= synchro && producers)
+		producers_events();
+#if WITH_IO_URING
+	if (synchro && callcount >= synchro && uring_input)
+		uring_read_enable(0);
+#endif
+}
+
+/* get the monotonic time in nanoseconds */
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* parse a duration like 10ms, 250us or 2s (default unit is ms) */
+static int parse_duration(const char *text, uint64_t *usec)
+{
+	char *end;
+	unsigned long long value;
+
+	errno = 0;
+	value = strtoull(text, &end, 10);
+	if (errno || end == text)
+		return -1;
+	if (!strcmp(end, "us"))
+		;
+	else if (!*end || !strcmp(end, "ms"))
+		value *= 1000;
+	else if (!strcmp(end, "s"))
+		value *= 1000000;
+	else
+		return -1;
+	*usec = (uint64_t)value;
+	return 0;
+}
+
+/* parse a size like 4096, 64k or 2M, returns 0 on error */
+static size_t parse_size(const char *text)
+{
+	char *end;
+	unsigned long long value;
+
+	errno = 0;
+	value = strtoull(text, &end, 10);
+	if (errno || end == text)
+		return 0;
+	if (*end == 'k' || *end == 'K')
+		value <<= 10, end++;
+	else if (*end == 'M')
+		value <<= 20, end++;
+	return *end ? 0 : (size_t)value;
+}
+
+/* get the statistics of name, creating it if needed */
+static struct stats *stats_get(const char *name)
+{
+	struct stats *stats;
+
+	for (stats = stats_head ; stats ; stats = stats->next)
+		if (!strcmp(stats->name, name))
+			return stats;
+
+	stats = calloc(1, sizeof *stats + strlen(name) + 1);
+	ensure_allocation(stats);
+	strcpy(stats->name, name);
+	stats->min = UINT64_MAX;
+	*(!stats_head ? &stats_head : &stats_tail->next) = stats;
+	stats_tail = stats;
+	return stats;
+}
+
+/* index in histogram of the value */
+static unsigned histo_index(uint64_t value)
+{
+	unsigned shift;
+
+	if (value < HISTO_SUB)
+		return (unsigned)value;
+	shift = (unsigned)(63 - __builtin_clzll(value)) - HISTO_SHIFT;
+	return shift * HISTO_SUB + (unsigned)(value >> shift);
+}
+
+/* greatest value recorded in the histogram at index */
+static uint64_t histo_value(unsigned index)
+{
+	unsigned shift;
+
+	if (index < 2 * HISTO_SUB)
+		return index;
+	shift = index / HISTO_SUB - 1;
+	return ((uint64_t)(index - shift * HISTO_SUB + 1) << shift) - 1;
+}
+
+/* record a latency (in nanoseconds) */
+static void stats_add(struct stats *stats, uint64_t latency, int iserror)
+{
+	stats->replied++;
+	if (iserror)
+		stats->errors++;
+	stats->sum += latency;
+	if (latency < stats->min)
+		stats->min = latency;
+	if (latency > stats->max)
+		stats->max = latency;
+	stats->histo[histo_index(latency)]++;
+}
+
+/* get the latency of the given percentile (in per mille) */
+static uint64_t stats_percentile(struct stats *stats, unsigned permille)
+{
+	unsigned idx;
+	unsigned long count, target;
+
+	target = (stats->replied * permille + 999) / 1000;
+	if (target == 0)
+		target = 1;
+	for (idx = 0, count = 0 ; idx < HISTO_COUNT ; idx++) {
+		count += stats->histo[idx];
+		if (count >= target)
+			break;
+	}
+	return idx < HISTO_COUNT && histo_value(idx) < stats->max ? histo_value(idx) : stats->max;
+}
+
+/* compare 2 latencies for qsort */
+static int latency_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/* get the lower median of the count latencies (reordered) */
+static uint64_t latency_median(uint64_t *latencies, unsigned count)
+{
+	qsort(latencies, count, sizeof *latencies, latency_cmp);
+	return latencies[(count - 1) / 2];
+}
+
+/* report the outliers of the endpoints, flagging the slow ones */
+static void endpoints_report()
+{
+	uint64_t p50s[nendpoints], median = 0;
+	unsigned idx, count;
+
+	for (idx = count = 0 ; idx < nendpoints ; idx++)
+		if (endpoints[idx].stats->replied)
+			p50s[count++] = stats_percentile(endpoints[idx].stats, 500);
+	if (count)
+		median = latency_median(p50s, count);
+	for (idx = 0 ; idx < nendpoints ; idx++)
+		report("STATS endpoint %s: %lu outliers%s\n", endpoints[idx].uri, endpoints[idx].outliers,
+			endpoints[idx].stats->replied
+			&& stats_percentile(endpoints[idx].stats, 500) > OUTLIER_FACTOR * median ? " SLOW" : "");
+}
+
+/* report the statistics */
+static void stats_report()
+{
+	struct stats *stats;
+	unsigned long replied = 0;
+	double elapsed = (double)(now_ns() - stats_origin) / 1e9;
+	unsigned idx;
+
+	report("\nSTATS %-26s %8s %8s %8s %9s %9s %9s %9s %9s %9s\n",
+		"(latencies in us)", "sent", "replied", "errors",
+		"min", "avg", "p50", "p90", "p99", "max");
+	for (stats = stats_head ; stats ; stats = stats->next) {
+		replied += stats->replied;
+		if (!stats->replied)
+			report("STATS %-26s %8lu %8lu %8lu\n", stats->name,
+				stats->sent, stats->replied, stats->errors);
+		else
+			report("STATS %-26s %8lu %8lu %8lu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+				stats->name, stats->sent, stats->replied, stats->errors,
+				(double)stats->min / 1e3,
+				(double)stats->sum / (double)stats->replied / 1e3,
+				(double)stats_percentile(stats, 500) / 1e3,
+				(double)stats_percentile(stats, 900) / 1e3,
+				(double)stats_percentile(stats, 990) / 1e3,
+				(double)stats->max / 1e3);
+	}
+	for (idx = 0 ; idx < scenario_count ; idx++)
+		report("STATS scenario %s: %lu runs\n", scenarios[idx]->name, scenarios[idx]->runs);
+	if (nendpoints)
+		endpoints_report();
+	if (evtrack)
+		events_report();
+	if (responder_file)
+		report("STATS responder: %lu replies\n", responder_replies);
+	if (churncount)
+		report("STATS churn: %u connections, %u failed, %.1f connections/s\n",
+			churn_started, churn_failed, elapsed > 0 ? (double)churn_started / elapsed : 0.0);
+	if (floor_measured)
+		report("STATS floor: clock %.0f ns (p50 %.0f ns), loop iteration %.0f ns (p50 %.0f ns)%s\n",
+			(double)floor_clock[0], (double)floor_clock[1],
+			(double)floor_loop[0], (double)floor_loop[1],
+			busypoll ? ", busy polling" : "");
+	if (busypoll_sockets)
+		report("STATS busy poll: %d sockets set to %d us\n", busypoll_sockets, BUSY_POLL_USEC);
+	report("STATS output: %zu bytes buffered (peak %zu), %lu events dropped, %llu bytes dropped\n",
+		buffered_bytes, buffered_peak, dropped_events, (unsigned long long)dropped_bytes);
+	report("STATS %lu replies in %.3f s: %.1f replies/s\n", replied, elapsed,
+		elapsed > 0 ? (double)replied / elapsed : 0.0);
+}
+
+/* creates a request record */
+static struct request *request_create(struct stats *stats, struct runner *runner, struct producer *producer, const char *fmt, ...)
+{
+	int rc;
+	va_list ap;
+	struct request *request = malloc(sizeof *request);
+
+	ensure_allocation(request);
+	va_start(ap, fmt);
+	rc = vasprintf(&request->key, fmt, ap);
+	va_end(ap);
+	if (rc < 0)
+		oom();
+	allocs[Alloc_Request]++;
+	allocs[Alloc_Key]++;
+	requests_sent++;
+	request->stats = stats;
+	request->runner = runner;
+	request->producer = producer;
+	request->endpoint = NULL;
+	request->group = NULL;
+	if (producer)
+		producer->refcount++;
+	if (stats)
+		stats->sent++;
+	request->start = now_ns();
+	return request;
+}
+
+/* releases a request record */
+static void request_destroy(struct request *request)
+{
+	if (request->producer)
+		producer_unref(request->producer);
+	free(request->key);
+	free(request);
+}
+
+static void runner_next(struct runner *runner, int deferred);
+
+/* terminates a group of broadcasted requests, flagging the slow endpoints */
+static void group_done(struct group *group)
+{
+	struct runner *runner = group->runner;
+	uint64_t latencies[group->count ?: 1], median;
+	unsigned idx;
+
+	if (group->count) {
+		for (idx = 0 ; idx < group->count ; idx++)
+			latencies[idx] = group->samples[idx].latency;
+		median = latency_median(latencies, group->count);
+		for (idx = 0 ; idx < group->count ; idx++) {
+			if (group->samples[idx].latency <= OUTLIER_FACTOR * median)
+				continue;
+			group->samples[idx].endpoint->outliers++;
+			if (!quiet)
+				print("ON-OUTLIER %s@%s: %.1f us, median %.1f us\n",
+					group->key, group->samples[idx].endpoint->uri,
+					(double)group->samples[idx].latency / 1e3, (double)median / 1e3);
+		}
+	}
+	idx = group->count;
+	free(group->key);
+	free(group);
+	if (runner && idx)
+		runner_next(runner, 0);
+}
+
+/* terminates a replied request at time stop */
+static void request_done(struct request *request, int iserror, uint64_t stop)
+{
+	struct runner *runner = request->runner;
+	struct group *group = request->group;
+	uint64_t latency = stop - request->start;
+
+	replies_received++;
+	if (request->stats)
+		stats_add(request->stats, latency, iserror);
+	if (request->endpoint)
+		stats_add(request->endpoint->stats, latency, iserror);
+	if (top_stats)
+		stats_add(top_stats, latency, iserror);
+	if (setup_connected) {
+		setup_record(Setup_First_Reply, setup_connected, stop);
+		setup_connected = 0;
+	}
+	if (group) {
+		group->samples[group->count].endpoint = request->endpoint;
+		group->samples[group->count++].latency = latency;
+	}
+	request_destroy(request);
+	dec_callcount();
+	if (group && !--group->remaining)
+		group_done(group);
+	if (runner)
+		runner_next(runner, 0);
+}
+
+/* releases a request that could not be sent */
+static void request_abort(struct request *request)
+{
+	struct group *group = request->group;
+
+	request_destroy(request);
+	dec_callcount();
+	if (group && !--group->remaining)
+		group_done(group);
+}
+
+/* get the endpoint for the next request of runner when sharding */
+static struct endpoint *endpoint_next(struct runner *runner)
+{
+	if (runner && runner->endpoint)
+		return runner->endpoint;
+	return &endpoints[endpoints_next++ % nendpoints];
+}
+
+/* creates the requests of key in requests, one per endpoint, returns their count */
+static unsigned requests_create(struct stats *stats, struct runner *runner, struct producer *producer, const char *key, struct request **requests)
+{
+	unsigned idx, count = fanout == Fanout_Broadcast ? nendpoints : 1;
+	struct endpoint *endpoint;
+	struct group *group = NULL;
+	struct request *request;
+
+	/* requests sent to many endpoints are grouped to compare their latencies */
+	if (count > 1) {
+		group = calloc(1, sizeof *group + count * sizeof *group->samples);
+		ensure_allocation(group);
+		group->key = strdup(key);
+		ensure_allocation(group->key);
+		allocs[Alloc_Key] += 2;
+		group->runner = runner;
+		group->remaining = count;
+		runner = NULL;
+	}
+	for (idx = 0 ; idx < count ; idx++) {
+		if (fanout == Fanout_None) {
+			request = request_create(stats, runner, producer, "%s", key);
+			endpoint = NULL;
+		}
+		else {
+			endpoint = fanout == Fanout_Broadcast ? &endpoints[idx] : endpoint_next(runner);
+			request = request_create(stats, runner, producer, "%s@%s", key, endpoint->uri);
+			endpoint->stats->sent++;
+		}
+		request->endpoint = endpoint;
+		request->group = group;
+		requests[idx] = request;
+		inc_callcount();
+	}
+	return count;
+}
+
+/* pick a scenario using the alias table */
+static struct scenario *scenario_pick()
+{
+	unsigned idx = (unsigned)(drand48() * scenario_count);
+
+	if (idx >= scenario_count)
+		idx = scenario_count - 1;
+	return scenarios[drand48() < aliases[idx].prob ? idx : aliases[idx].index];
+}
+
+/* emits the current step of the runner */
+static void runner_emit(struct runner *runner)
+{
+	struct step *step = runner->step;
+	int rc;
+
+	if (direct)
+		rc = pws_call(step->verb, step->object, runner, NULL);
+	else
+		rc = wsj1_emit(step->api, step->verb, step->object, runner, NULL);
+	if (rc >= 0)
+		runner->failures = 0;
+	else {
+		if (step->stats)
+			step->stats->errors++;
+		if (++runner->failures >= RUNNER_MAX_FAILURES) {
+			error("scenario stopped after %u failures\n", runner->failures);
+			runners_active--;
+			free(runner);
+			return;
+		}
+		/* retry the step: runner_next counts it as done */
+		runner->remain++;
+	}
+	if (rc < 0 || (step->api && !strcmp(step->api, "!")))
+		runner_next(runner, 1);
+}
+
+/* starts a new scenario in the runner or stops it */
+static void runner_start(struct runner *runner)
+{
+	struct scenario *scenario;
+
+	if (interrupted || (runcount && runstarted >= runcount)) {
+		runners_active--;
+		free(runner);
+		return;
+	}
+	runstarted++;
+	runner->session = nsessions ? (uint16_t)(1 + sessions_next++ % nsessions) : numuuid;
+	scenario = scenario_pick();
+	scenario->runs++;
+	runner->step = scenario->steps;
+	runner->remain = runner->step->repeat;
+	runner->endpoint = fanout == Fanout_Shard ? endpoint_next(NULL) : NULL;
+	runner_emit(runner);
+}
+
+/* advance the runner after its think time */
+static int on_runner_timer(sd_event_source *src, uint64_t usec, void *closure)
+{
+	struct runner *runner = closure;
+	struct step *step = runner->step;
+
+	sd_event_source_unref(src);
+	runner->timer = NULL;
+	if (runner->remain)
+		runner_emit(runner);
+	else if (step->next) {
+		runner->step = step->next;
+		runner->remain = runner->step->repeat;
+		runner_emit(runner);
+	}
+	else
+		runner_start(runner);
+	return 0;
+}
+
+/* called when the current step of the runner completed */
+static void runner_next(struct runner *runner, int deferred)
+{
+	struct step *step = runner->step;
+	uint64_t usec;
+
+	runner->remain--;
+	if (step->think || deferred) {
+		sd_event_now(loop, CLOCK_MONOTONIC, &usec);
+		if (runner->failures)
+			usec += (uint64_t)RUNNER_BACKOFF_USEC << (runner->failures - 1);
+		if (sd_event_add_time(loop, &runner->timer, CLOCK_MONOTONIC,
+				usec + step->think, 0, on_runner_timer, runner) < 0)
+			fatal();
+	}
+	else if (runner->remain)
+		runner_emit(runner);
+	else if (step->next) {
+		runner->step = step->next;
+		runner->remain = runner->step->repeat;
+		runner_emit(runner);
+	}
+	else
+		runner_start(runner);
+}
+
+/* check if SIGINT or SIGTERM waits for the loop, for waiting outside of it */
+static int signal_pending()
+{
+	sigset_t sigs;
+
+	return sigpending(&sigs) == 0
+		&& (sigismember(&sigs, SIGINT) == 1 || sigismember(&sigs, SIGTERM) == 1);
+}
+
+/* called on SIGINT or SIGTERM */
+static int on_signal(sd_event_source *src, const struct signalfd_siginfo *si, void *closure)
+{
+	interrupted = 1;
+	return 0;
+}
+
+/* stop gracefully on SIGINT or SIGTERM */
+static void catch_signals()
+{
+	sigset_t sigs;
+
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigprocmask(SIG_BLOCK, &sigs, NULL);
+	if (sd_event_add_signal(loop, NULL, SIGINT, on_signal, NULL) < 0
+	 || sd_event_add_signal(loop, NULL, SIGTERM, on_signal, NULL) < 0)
+		fatal();
+}
+
+/* starts count runners of scenarios */
+static void scenario_start(unsigned count)
+{
+	struct runner *runner;
+
+	catch_signals();
+	srand48((long)now_ns() ^ getpid());
+	while (count--) {
+		runner = calloc(1, sizeof *runner);
+		ensure_allocation(runner);
+		runners_active++;
+		runner_start(runner);
+	}
+}
+
+/* builds the alias table of the weighted scenarios (Vose's method) */
+static void scenario_alias()
+{
+	unsigned idx, nsmall, nlarge, s, l, *small, *large;
+	unsigned long total = 0;
+	double *prob;
+
+	aliases = calloc(scenario_count, sizeof *aliases);
+	prob = calloc(scenario_count, sizeof *prob);
+	small = calloc(scenario_count, sizeof *small);
+	large = calloc(scenario_count, sizeof *large);
+	ensure_allocation(aliases);
+	ensure_allocation(prob);
+	ensure_allocation(small);
+	ensure_allocation(large);
+
+	for (idx = 0 ; idx < scenario_count ; idx++)
+		total += scenarios[idx]->weight;
+	for (idx = nsmall = nlarge = 0 ; idx < scenario_count ; idx++) {
+		prob[idx] = (double)scenarios[idx]->weight * scenario_count / (double)total;
+		if (prob[idx] < 1.0)
+			small[nsmall++] = idx;
+		else
+			large[nlarge++] = idx;
+	}
+	while (nsmall && nlarge) {
+		s = small[--nsmall];
+		l = large[--nlarge];
+		aliases[s].prob = prob[s];
+		aliases[s].index = l;
+		prob[l] = prob[l] + prob[s] - 1.0;
+		if (prob[l] < 1.0)
+			small[nsmall++] = l;
+		else
+			large[nlarge++] = l;
+	}
+	while (nlarge) {
+		l = large[--nlarge];
+		aliases[l].prob = 1.0;
+		aliases[l].index = l;
+	}
+	while (nsmall) {
+		s = small[--nsmall];
+		aliases[s].prob = 1.0;
+		aliases[s].index = s;
+	}
+	free(prob);
+	free(small);
+	free(large);
+}
+
+/* exits on scenario syntax error */
+static void scenario_error(const char *path, unsigned lino, const char *msg)
+{
+	error("%s:%u: %s\n", path, lino, msg);
+	exit(Exit_Bad_Arg);
+}
+
+/* load the scenarios of the file of path */
+static void scenario_load(const char *path)
+{
+	FILE *file;
+	char *line = NULL, *head, *f1, *f2, *rem, *name;
+	size_t size = 0;
+	ssize_t len;
+	unsigned lino = 0, num = 0, weight, idx;
+	uint64_t think;
+	struct scenario *scenario = NULL, *list = NULL, **ptail = &list;
+	struct step *step = NULL, **pstep = NULL;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		error("can't open scenario file %s: %m\n", path);
+		exit(Exit_Bad_Arg);
+	}
+	while ((len = getline(&line, &size, file)) >= 0) {
+		lino++;
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = 0;
+		head = &line[strspn(line, sep)];
+		if (!*head || *head == '#')
+			continue;
+
+		if (*head == '[') {
+			/* [NAME WEIGHT]: starts a new scenario */
+			name = &head[1 + strspn(&head[1], sep)];
+			rem = &name[strcspn(name, " \t]")];
+			weight = 1;
+			if (*rem != ']') {
+				*rem++ = 0;
+				weight = (unsigned)strtoul(rem, &rem, 10);
+				rem = &rem[strspn(rem, sep)];
+			}
+			if (*rem != ']' || rem == name || weight == 0)
+				scenario_error(path, lino, "bad scenario header, expected [NAME WEIGHT]");
+			*rem = 0;
+			scenario = calloc(1, sizeof *scenario + strlen(name) + 1);
+			ensure_allocation(scenario);
+			strcpy(scenario->name, name);
+			scenario->weight = weight;
+			*ptail = scenario;
+			ptail = &scenario->next;
+			pstep = &scenario->steps;
+			step = NULL;
+			num = 0;
+			scenario_count++;
+		}
+		else if (*head == '@') {
+			/* @repeat COUNT or @think DURATION: modifies the previous step */
+			f1 = &head[1];
+			rem = &f1[strcspn(f1, sep)];
+			if (*rem)
+				*rem++ = 0;
+			rem = &rem[strspn(rem, sep)];
+			if (step == NULL)
+				scenario_error(path, lino, "directive without step");
+			if (!strcmp(f1, "repeat") && atoi(rem) > 0)
+				step->repeat = (unsigned)atoi(rem);
+			else if (!strcmp(f1, "think") && !parse_duration(rem, &think))
+				step->think = think;
+			else
+				scenario_error(path, lino, "bad directive, expected @repeat COUNT or @think DURATION");
+		}
+		else {
+			/* a request step, same syntax as input lines */
+			if (scenario == NULL)
+				scenario_error(path, lino, "step outside of scenario");
+			f1 = head;
+			rem = &f1[strcspn(f1, sep)];
+			if (*rem)
+				*rem++ = 0;
+			rem = &rem[strspn(rem, sep)];
+			if (direct)
+				f2 = NULL;
+			else {
+				f2 = rem;
+				rem = &f2[strcspn(f2, sep)];
+				if (*rem)
+					*rem++ = 0;
+				rem = &rem[strspn(rem, sep)];
+				if (!*f2)
+					scenario_error(path, lino, "verb missing");
+			}
+			step = calloc(1, sizeof *step);
+			ensure_allocation(step);
+			step->api = f2 ? strdup(f1) : NULL;
+			step->verb = strdup(f2 ?: f1);
+			step->object = strdup(rem);
+			ensure_allocation(step->verb);
+			ensure_allocation(step->object);
+			if (f2)
+				ensure_allocation(step->api);
+			step->repeat = 1;
+			if (f2 && !strcmp(f1, "!"))
+				name = NULL;
+			else {
+				if (f2)
+					len = asprintf(&name, "%s#%u:%s/%s", scenario->name, ++num, f1, f2);
+				else
+					len = asprintf(&name, "%s#%u:%s", scenario->name, ++num, f1);
+				if (len < 0)
+					oom();
+				step->stats = stats_get(name);
+				free(name);
+			}
+			*pstep = step;
+			pstep = &step->next;
+		}
+	}
+	free(line);
+	fclose(file);
+
+	/* check and index the scenarios */
+	if (scenario_count == 0)
+		scenario_error(path, lino, "no scenario");
+	scenarios = calloc(scenario_count, sizeof *scenarios);
+	ensure_allocation(scenarios);
+	for (idx = 0, scenario = list ; scenario ; scenario = scenario->next) {
+		if (scenario->steps == NULL) {
+			error("%s: scenario %s has no step\n", path, scenario->name);
+			exit(Exit_Bad_Arg);
+		}
+		scenarios[idx++] = scenario;
+	}
+	scenario_alias();
+}
+
+/* read the counts of bytes read and written by the process */
+/* count the bytes read by stdio from file as input */
+static void count_file_input(FILE *file)
+{
+	off_t pos = lseek(fileno(file), 0, SEEK_CUR);
+
+	if (pos > 0)
+		input_bytes += (uint64_t)pos;
+}
+
+/* get the counts of bytes read and written, the read itself is counted as input */
+static int read_proc_io(uint64_t *rchar, uint64_t *wchar)
+{
+	FILE *file;
+	char name[32];
+	unsigned long long value;
+	int found = 0;
+
+	file = fopen("/proc/self/io", "r");
+	if (file == NULL)
+		return -1;
+	while (fscanf(file, "%31[^:]: %llu\n", name, &value) == 2) {
+		if (!strcmp(name, "rchar")) {
+			*rchar = (uint64_t)value;
+			found |= 1;
+		}
+		else if (!strcmp(name, "wchar")) {
+			*wchar = (uint64_t)value;
+			found |= 2;
+		}
+	}
+	count_file_input(file);
+	fclose(file);
+	return found == 3 ? 0 : -1;
+}
+
+/* get the CPU time consumed by the process in nanoseconds */
+static uint64_t cpu_ns()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ((uint64_t)ru.ru_utime.tv_sec + (uint64_t)ru.ru_stime.tv_sec) * 1000000000
+		+ ((uint64_t)ru.ru_utime.tv_usec + (uint64_t)ru.ru_stime.tv_usec) * 1000;
+}
+
+/* take a snapshot of the costs of the process */
+static void cost_snapshot(struct cost *cost)
+{
+	struct rusage ru;
+
+	cost->time = now_ns();
+	getrusage(RUSAGE_SELF, &ru);
+	cost->user = (uint64_t)ru.ru_utime.tv_sec * 1000000000 + (uint64_t)ru.ru_utime.tv_usec * 1000;
+	cost->sys = (uint64_t)ru.ru_stime.tv_sec * 1000000000 + (uint64_t)ru.ru_stime.tv_usec * 1000;
+	cost->nvcsw = ru.ru_nvcsw;
+	cost->nivcsw = ru.ru_nivcsw;
+	cost->maxrss = ru.ru_maxrss;
+	/* rchar counts the read of /proc/self/io at the next snapshot */
+	cost->input = input_bytes;
+	if (read_proc_io(&cost->rchar, &cost->wchar) < 0)
+		cost->rchar = cost->wchar = 0;
+	cost->output = output_bytes;
+	cost->uring_input = uring_input_bytes;
+	cost->uring_output = uring_output_bytes;
+	cost->requests = requests_sent;
+	cost->replies = replies_received;
+	cost->events = events_received;
+	memcpy(cost->allocs, allocs, sizeof allocs);
+}
+
+/* report the costs between the snapshots from and to */
+static void cost_report(const char *title, struct cost *from, struct cost *to)
+{
+	static const char *names[Alloc_Count] = { "output", "pendings", "input", "keys", "requests" };
+	double elapsed = (double)(to->time - from->time) / 1e9;
+	unsigned long requests = to->requests - from->requests;
+	unsigned long messages = (to->replies - from->replies) + (to->events - from->events);
+	unsigned long count = 0;
+	uint64_t rwire = (to->rchar - from->rchar) - (to->input - from->input);
+	uint64_t wwire = (to->wchar - from->wchar) - (to->output - from->output);
+	unsigned idx;
+
+	report("COST %s %.3f s: %lu requests, %lu replies, %lu events, %.1f replies/s\n",
+		title, elapsed, requests, to->replies - from->replies, to->events - from->events,
+		elapsed > 0 ? (double)(to->replies - from->replies) / elapsed : 0.0);
+	report("COST cpu: user %.3f s, sys %.3f s, %.1f us/request\n",
+		(double)(to->user - from->user) / 1e9, (double)(to->sys - from->sys) / 1e9,
+		requests ? (double)(to->user - from->user + to->sys - from->sys) / requests / 1e3 : 0.0);
+	report("COST context switches: %ld voluntary, %ld involuntary, max rss %ld kB\n",
+		to->nvcsw - from->nvcsw, to->nivcsw - from->nivcsw, to->maxrss);
+	report("COST allocations:");
+	for (idx = 0 ; idx < Alloc_Count ; idx++) {
+		count += to->allocs[idx] - from->allocs[idx];
+		report(" %s %lu,", names[idx], to->allocs[idx] - from->allocs[idx]);
+	}
+	report(" %.1f/request\n", requests ? (double)count / requests : 0.0);
+
+	/* io_uring and send are not accounted in /proc/self/io, nor deduced */
+	report("COST wire: %llu bytes written, %.1f/request, %llu bytes read, %.1f/reply or event\n",
+		(unsigned long long)wwire, requests ? (double)wwire / requests : 0.0,
+		(unsigned long long)rwire, messages ? (double)rwire / messages : 0.0);
+	if (to->uring_input != from->uring_input || to->uring_output != from->uring_output)
+		report("COST io_uring: %llu bytes written, %llu bytes read\n",
+			(unsigned long long)(to->uring_output - from->uring_output),
+			(unsigned long long)(to->uring_input - from->uring_input));
+}
+
+/* report the costs since the start at exit */
+static void cost_exit()
+{
+	struct cost cost;
+
+	cost_snapshot(&cost);
+	report("\n");
+	cost_report("total", &cost_origin, &cost);
+}
+
+/* report periodically the costs of the last interval */
+static int on_cost_timer(sd_event_source *src, uint64_t usec, void *closure)
+{
+	struct cost cost;
+
+	sd_event_source_unref(src);
+	cost_snapshot(&cost);
+	cost_report("interval", &cost_last, &cost);
+	cost_last = cost;
+	if (sd_event_add_time(loop, &cost_timer, CLOCK_MONOTONIC, usec + cost_interval, 0, on_cost_timer, NULL) < 0)
+		fatal();
+	return 0;
+}
+
+/* start the accounting of costs */
+static void cost_start()
+{
+	uint64_t usec;
+
+	cost_snapshot(&cost_origin);
+	cost_last = cost_origin;
+	atexit(cost_exit);
+	if (cost_interval) {
+		sd_event_now(loop, CLOCK_MONOTONIC, &usec);
+		if (sd_event_add_time(loop, &cost_timer, CLOCK_MONOTONIC, usec + cost_interval, 0, on_cost_timer, NULL) < 0)
+			fatal();
+	}
+}
+
+/* get the counter of the event of name, creating it if needed */
+static struct evcount *evcount_get(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	const char *iter;
+	struct evcount *evcount;
+
+	for (iter = name ; *iter ; iter++)
+		hash = (hash ^ (unsigned char)*iter) * 16777619u;
+	hash %= EVCOUNT_BUCKETS;
+	for (evcount = evcounts[hash] ; evcount ; evcount = evcount->next)
+		if (!strcmp(evcount->name, name))
+			return evcount;
+
+	evcount = calloc(1, sizeof *evcount + strlen(name) + 1);
+	ensure_allocation(evcount);
+	strcpy(evcount->name, name);
+	evcount->next = evcounts[hash];
+	evcounts[hash] = evcount;
+	return evcount;
+}
+
+/* count the received event of name when counters are used */
+static struct evcount *event_counted(const char *name)
+{
+	struct evcount *evcount;
+
+	if (!top && !evtrack)
+		return NULL;
+	evcount = evcount_get(name);
+	evcount->count++;
+	return evcount;
+}
+
+/* get the counters of the event ids of the WSAPI connection of closure */
+static struct evcount **event_ids(void *closure)
+{
+	struct endpoint *endpoint = closure;
+	struct evcount ***ids = endpoint ? &endpoint->ids : &evcount_ids;
+
+	if (!*ids && (top || evtrack)) {
+		*ids = calloc(UINT16_MAX + 1, sizeof **ids);
+		ensure_allocation(*ids);
+	}
+	return *ids;
+}
+
+/* count the received event of id when counters are used */
+static struct evcount *event_counted_id(void *closure, uint16_t event_id)
+{
+	struct evcount **ids = event_ids(closure);
+	char name[8];
+
+	if (ids && ids[event_id]) {
+		ids[event_id]->count++;
+		return ids[event_id];
+	}
+	snprintf(name, sizeof name, "#%u", (unsigned)event_id);
+	return event_counted(name);
+}
+
+/* skip the JSON value of text, returns its end or NULL if malformed */
+static const char *json_skip(const char *text)
+{
+	int depth = 0;
+
+	do {
+		text += strspn(text, " \t\n\r");
+		if (*text == '"') {
+			while (*++text != '"')
+				if (!*text || (*text == '\\' && !*++text))
+					return NULL;
+			text++;
+		}
+		else if (*text == '{' || *text == '[')
+			depth++, text++;
+		else if ((*text == '}' || *text == ']' || *text == ',' || *text == ':') && depth) {
+			if (*text == '}' || *text == ']')
+				depth--;
+			text++;
+		}
+		else if (*text && !strchr("}],:", *text))
+			text += strcspn(text, " \t\n\r{}[],:\"");
+		else
+			return NULL;
+	} while (depth);
+	return text;
+}
+
+/* get the value at path (keys or indexes separated by dots) in the JSON text
+ * without building the tree, returns NULL if not found */
+static const char *json_scan(const char *text, const char *path)
+{
+	size_t len;
+	unsigned long index;
+
+	while (text && *path) {
+		len = strcspn(path, ".");
+		text += strspn(text, " \t\n\r");
+		if (*text == '{') {
+			/* search the member of key */
+			text++;
+			for (;;) {
+				text += strspn(text, " \t\n\r");
+				if (*text != '"')
+					return NULL;
+				if (!strncmp(text + 1, path, len) && text[len + 1] == '"') {
+					text += len + 2;
+					break;
+				}
+				text = json_skip(text);
+				if (text == NULL)
+					return NULL;
+				text += strspn(text, " \t\n\r");
+				if (*text++ != ':' || !(text = json_skip(text)))
+					return NULL;
+				text += strspn(text, " \t\n\r");
+				if (*text++ != ',')
+					return NULL;
+			}
+			text += strspn(text, " \t\n\r");
+			if (*text++ != ':')
+				return NULL;
+		}
+		else if (*text == '[') {
+			/* search the item of index */
+			index = strtoul(path, NULL, 10);
+			text++;
+			while (text && index--) {
+				text = json_skip(text);
+				if (text) {
+					text += strspn(text, " \t\n\r");
+					text = *text == ',' ? text + 1 : NULL;
+				}
+			}
+		}
+		else
+			return NULL;
+		path += len + (path[len] == '.');
+	}
+	if (text)
+		text += strspn(text, " \t\n\r");
+	return text;
+}
+
+/* get the number of the JSON text, quoted or not, returns 0 if not a number */
+static int json_number(const char *text, double *value)
+{
+	char *end;
+
+	if (text == NULL)
+		return 0;
+	if (*text == '"')
+		text++;
+	*value = strtod(text, &end);
+	return end != text;
+}
+
+/* get the number at path in the JSON object, returns 0 if not a number */
+static int json_object_number(struct json_object *object, const char *path, double *value)
+{
+	char key[256];
+	size_t len;
+
+	while (object && *path) {
+		len = strcspn(path, ".");
+		if (len >= sizeof key)
+			return 0;
+		memcpy(key, path, len);
+		key[len] = 0;
+		if (json_object_is_type(object, json_type_array))
+			object = json_object_array_get_idx(object, strtoul(key, NULL, 10));
+		else if (!json_object_object_get_ex(object, key, &object))
+			return 0;
+		path += len + (path[len] == '.');
+	}
+	if (!json_object_is_type(object, json_type_int)
+	 && !json_object_is_type(object, json_type_double)
+	 && !json_object_is_type(object, json_type_string))
+		return 0;
+	errno = 0;
+	*value = json_object_get_double(object);
+	return !errno;
+}
+
+/* set whether the sequence number is missing, in the window of the last numbers */
+static void seq_mark(struct evcount *evcount, uint64_t number, int missing)
+{
+	uint64_t bit = (uint64_t)1 << (number % 64);
+
+	if (missing)
+		evcount->missing[number / 64 % (SEQ_WINDOW / 64)] |= bit;
+	else
+		evcount->missing[number / 64 % (SEQ_WINDOW / 64)] &= ~bit;
+}
+
+/* check whether the sequence number, in the window of the last numbers, is missing */
+static int seq_missing(struct evcount *evcount, uint64_t number)
+{
+	return !!(evcount->missing[number / 64 % (SEQ_WINDOW / 64)] & ((uint64_t)1 << (number % 64)));
+}
+
+/* record the timestamp and the sequence number of a received event */
+static void event_record(struct evcount *evcount, int hastime, double time, int hasseq, double seq)
+{
+	struct timespec ts;
+	uint64_t now, stamp, number, iter;
+	char *name;
+
+	if (hastime && time >= 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		now = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+		stamp = (uint64_t)(time * (double)event_time_unit);
+		if (!evcount->stats) {
+			if (asprintf(&name, "event:%s", evcount->name) < 0)
+				oom();
+			evcount->stats = stats_get(name);
+			free(name);
+		}
+		if (stamp > now)
+			evcount->ahead++;
+		else {
+			evcount->stats->sent++;
+			stats_add(evcount->stats, now - stamp, 0);
+		}
+	}
+	if (hasseq && seq >= 0) {
+		number = (uint64_t)seq;
+		if (!evcount->sequenced) {
+			evcount->sequenced = 1;
+			evcount->seq_next = number + 1;
+		}
+		else if (number >= evcount->seq_next) {
+			/* a gap: the events in between are lost unless they come late */
+			if (number > evcount->seq_next) {
+				evcount->gaps++;
+				evcount->lost += number - evcount->seq_next;
+			}
+			iter = number - evcount->seq_next < SEQ_WINDOW ? evcount->seq_next : number - SEQ_WINDOW + 1;
+			for ( ; iter < number ; iter++)
+				seq_mark(evcount, iter, 1);
+			seq_mark(evcount, number, 0);
+			evcount->seq_next = number + 1;
+		}
+		else if (evcount->seq_next - number <= SEQ_WINDOW) {
+			if (seq_missing(evcount, number)) {
+				/* a late event, previously counted as lost */
+				seq_mark(evcount, number, 0);
+				evcount->reordered++;
+				evcount->lost--;
+			}
+			else
+				evcount->duplicates++;
+		}
+		else {
+			/* far behind, the producer restarted its sequence */
+			evcount->resets++;
+			memset(evcount->missing, 0, sizeof evcount->missing);
+			evcount->seq_next = number + 1;
+		}
+	}
+}
+
+/* extract timestamp and sequence number of the event from its JSON text */
+static void event_track_text(struct evcount *evcount, const char *text)
+{
+	double time = 0, seq = 0;
+	int hastime, hasseq;
+
+	/* paths are relative to the data of the event, as with WSAPI */
+	text = json_scan(text, "data");
+	hastime = event_time_path && json_number(json_scan(text, event_time_path), &time);
+	hasseq = event_seq_path && json_number(json_scan(text, event_seq_path), &seq);
+	event_record(evcount, hastime, time, hasseq, seq);
+}
+
+/* extract timestamp and sequence number of the event from its JSON object */
+static void event_track_json(struct evcount *evcount, struct json_object *object)
+{
+	double time = 0, seq = 0;
+	int hastime, hasseq;
+
+	hastime = event_time_path && json_object_number(object, event_time_path, &time);
+	hasseq = event_seq_path && json_object_number(object, event_seq_path, &seq);
+	event_record(evcount, hastime, time, hasseq, seq);
+}
+
+/* report the losses and reorderings of the tracked events */
+static void events_report()
+{
+	unsigned idx;
+	struct evcount *evcount;
+
+	for (idx = 0 ; idx < EVCOUNT_BUCKETS ; idx++)
+		for (evcount = evcounts[idx] ; evcount ; evcount = evcount->next) {
+			report("STATS event %s: %lu received", evcount->name, evcount->count);
+			if (event_seq_path)
+				report(", %lu lost in %lu gaps, %lu reordered, %lu duplicates, %lu resets",
+					evcount->lost, evcount->gaps, evcount->reordered,
+					evcount->duplicates, evcount->resets);
+			if (event_time_path && evcount->ahead)
+				report(", %lu timestamps ahead of the clock", evcount->ahead);
+			report("\n");
+		}
+}
+
+/* append to the panel of size at *pos */
+static void top_add(char *panel, size_t size, size_t *pos, const char *fmt, ...)
+{
+	int rc;
+	va_list ap;
+
+	if (*pos >= size)
+		return;
+	va_start(ap, fmt);
+	rc = vsnprintf(&panel[*pos], size - *pos, fmt, ap);
+	va_end(ap);
+	if (rc > 0)
+		*pos += (size_t)rc;
+}
+
+/* output the panel */
+static void top_print(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	out(1, fmt, ap);
+	va_end(ap);
+}
+
+/* draw the status panel */
+static void top_draw()
+{
+	char panel[4096];
+	size_t pos = 0;
+	uint64_t now = now_ns();
+	double period = (double)(now - top_last) / 1e9;
+	struct evcount *best[TOP_EVENTS], *evcount;
+	unsigned long rates[TOP_EVENTS], rate;
+	unsigned idx, slot, count = 0;
+
+	/* select the events of greatest rates of the period */
+	for (idx = 0 ; idx < EVCOUNT_BUCKETS ; idx++)
+		for (evcount = evcounts[idx] ; evcount ; evcount = evcount->next) {
+			rate = evcount->count - evcount->last;
+			evcount->last = evcount->count;
+			if (!rate || (count == TOP_EVENTS && rate <= rates[count - 1]))
+				continue;
+			slot = count < TOP_EVENTS ? count++ : count - 1;
+			for ( ; slot && rates[slot - 1] < rate ; slot--) {
+				rates[slot] = rates[slot - 1];
+				best[slot] = best[slot - 1];
+			}
+			rates[slot] = rate;
+			best[slot] = evcount;
+		}
+
+	/* compose the panel */
+	top_add(panel, sizeof panel, &pos, "\033[H\033[2J");
+	top_add(panel, sizeof panel, &pos, "afb-client  uptime %.1f s\n\n", (double)(now - top_origin) / 1e9);
+	top_add(panel, sizeof panel, &pos, "requests  %10.1f req/s   %lu replies, %lu errors\n",
+		period > 0 ? (double)(top_stats->replied - top_replies_last) / period : 0.0,
+		top_stats->replied, top_stats->errors);
+	if (synchro)
+		top_add(panel, sizeof panel, &pos, "in-flight %10d / %d     %lu pending\n", callcount, synchro, pendings_count);
+	else
+		top_add(panel, sizeof panel, &pos, "in-flight %10d         %lu pending\n", callcount, pendings_count);
+	if (top_stats->replied)
+		top_add(panel, sizeof panel, &pos, "latency   p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+			(double)stats_percentile(top_stats, 500) / 1e3,
+			(double)stats_percentile(top_stats, 900) / 1e3,
+			(double)stats_percentile(top_stats, 990) / 1e3,
+			(double)top_stats->max / 1e3);
+	else
+		top_add(panel, sizeof panel, &pos, "latency   -\n");
+	top_add(panel, sizeof panel, &pos, "output    %zu bytes buffered (peak %zu), %lu events dropped\n",
+		buffered_bytes, buffered_peak, dropped_events);
+	top_add(panel, sizeof panel, &pos, "bodies    %lu suppressed\n\n", top_suppressed);
+	top_add(panel, sizeof panel, &pos, "%12s %10s  %s\n", "events/s", "total", "event");
+	for (idx = 0 ; idx < count ; idx++)
+		top_add(panel, sizeof panel, &pos, "%12.1f %10lu  %s\n",
+			period > 0 ? (double)rates[idx] / period : 0.0, best[idx]->count, best[idx]->name);
+
+	/* one write for the whole panel */
+	top_last = now;
+	top_replies_last = top_stats->replied;
+	top_print("%s", panel);
+#if WITH_READLINE
+	/* the panel cleared the line being typed, redraw it below */
+	if (ontty && evsrc && !buffered_bytes)
+		rl_forced_update_display();
+#endif
+}
+
+/* redraw the panel periodically */
+static int on_top_timer(sd_event_source *src, uint64_t usec, void *closure)
+{
+	sd_event_source_unref(src);
+	top_draw();
+	if (sd_event_add_time(loop, &top_timer, CLOCK_MONOTONIC, usec + TOP_REFRESH_USEC, 0, on_top_timer, NULL) < 0)
+		fatal();
+	return 0;
+}
+
+/* start the status panel */
+static void top_start()
+{
+	uint64_t usec;
+
+	top_stats = calloc(1, sizeof *top_stats + 1);
+	ensure_allocation(top_stats);
+	top_stats->min = UINT64_MAX;
+	top_origin = top_last = now_ns();
+	sd_event_now(loop, CLOCK_MONOTONIC, &usec);
+	if (sd_event_add_time(loop, &top_timer, CLOCK_MONOTONIC, usec + TOP_REFRESH_USEC, 0, on_top_timer, NULL) < 0)
+		fatal();
+}
+
+/* load from stdin the workload to compare */
+static void compare_load()
+{
+	char *line = NULL, *head;
+	size_t size = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &size, stdin)) >= 0) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = 0;
+		head = &line[strspn(line, sep)];
+		if (!*head || *head == '#')
+			continue;
+		if (*head == '!' || !head[strcspn(head, sep)]) {
+			error("ignoring line without call: %s\n", head);
+			continue;
+		}
+		compare_lines = realloc(compare_lines, (compare_count + 1) * sizeof *compare_lines);
+		ensure_allocation(compare_lines);
+		compare_lines[compare_count] = strdup(head);
+		ensure_allocation(compare_lines[compare_count++]);
+	}
+	free(line);
+	if (!compare_count) {
+		error("no request to compare\n");
+		exit(Exit_Input_Fail);
+	}
+}
+
+/* records the beginning (begin != 0) or the end of a phase */
+static void compare_measure(struct phase *phase, int begin)
+{
+	uint64_t rchar, wchar, input = input_bytes;
+	int known = !read_proc_io(&rchar, &wchar);
+
+	if (begin) {
+		phase->wire_known = known;
+		phase->wire_received = rchar - input;
+		phase->wire_sent = wchar - output_bytes;
+		phase->cpu = cpu_ns();
+		phase->start = now_ns();
+	}
+	else {
+		phase->stop = now_ns();
+		phase->cpu = cpu_ns() - phase->cpu;
+		phase->wire_known = phase->wire_known && known;
+		phase->wire_received = (rchar - input) - phase->wire_received;
+		phase->wire_sent = (wchar - output_bytes) - phase->wire_sent;
+	}
+}
+
+/* report the comparison side by side */
+static void compare_report()
+{
+	struct phase *a = &compare_phases[0], *b = &compare_phases[1];
+	double da = (double)(a->stop - a->start) / 1e9, db = (double)(b->stop - b->start) / 1e9;
+	double na = (double)(a->stats->replied ?: 1), nb = (double)(b->stats->replied ?: 1);
+
+	report("\nCOMPARE %-24s %14s %14s\n", "", a->name, b->name);
+	report("COMPARE %-24s %14lu %14lu\n", "requests", a->stats->sent, b->stats->sent);
+	report("COMPARE %-24s %14lu %14lu\n", "errors", a->stats->errors, b->stats->errors);
+	report("COMPARE %-24s %14.3f %14.3f\n", "duration (s)", da, db);
+	report("COMPARE %-24s %14.1f %14.1f\n", "throughput (req/s)",
+		da > 0 ? (double)a->stats->replied / da : 0.0,
+		db > 0 ? (double)b->stats->replied / db : 0.0);
+	report("COMPARE %-24s %14.1f %14.1f\n", "latency p50 (us)",
+		(double)stats_percentile(a->stats, 500) / 1e3, (double)stats_percentile(b->stats, 500) / 1e3);
+	report("COMPARE %-24s %14.1f %14.1f\n", "latency p90 (us)",
+		(double)stats_percentile(a->stats, 900) / 1e3, (double)stats_percentile(b->stats, 900) / 1e3);
+	report("COMPARE %-24s %14.1f %14.1f\n", "latency p99 (us)",
+		(double)stats_percentile(a->stats, 990) / 1e3, (double)stats_percentile(b->stats, 990) / 1e3);
+	report("COMPARE %-24s %14.1f %14.1f\n", "latency max (us)",
+		(double)a->stats->max / 1e3, (double)b->stats->max / 1e3);
+	if (a->wire_known && b->wire_known) {
+		report("COMPARE %-24s %14.1f %14.1f\n", "bytes sent/request",
+			(double)a->wire_sent / na, (double)b->wire_sent / nb);
+		report("COMPARE %-24s %14.1f %14.1f\n", "bytes received/request",
+			(double)a->wire_received / na, (double)b->wire_received / nb);
+	}
+	report("COMPARE %-24s %14.2f %14.2f\n", "client cpu/request (us)",
+		(double)a->cpu / na / 1e3, (double)b->cpu / nb / 1e3);
+}
+
+/* terminates the current phase of comparison and starts the next one */
+static void compare_next_phase()
+{
+	struct phase *phase;
+	unsigned idx, pass, passes = runcount ? (unsigned)runcount : 1;
+	char *line;
+
+	/* terminate the current phase */
+	if (compare_index >= 0)
+		compare_measure(&compare_phases[compare_index], 0);
+	if (++compare_index >= 2) {
+		compare_index = -1;
+		compare_stats = NULL;
+		compare_report();
+		return;
+	}
+
+	/* queue the workload of the new phase */
+	phase = &compare_phases[compare_index];
+	direct = compare_index;
+	phase->name = direct ? "wsapi" : "wsj1";
+	phase->stats = compare_stats = stats_get(phase->name);
+	for (pass = 0 ; pass < passes ; pass++)
+		for (idx = 0 ; idx < compare_count ; idx++) {
+			/* WSAPI is direct: the api is removed */
+			line = compare_lines[idx];
+			if (direct)
+				line += strcspn(line, sep);
+			line = strdup(line);
+			ensure_allocation(line);
+			pendings_add(line, NULL);
+		}
+
+	/* start the phase */
+	compare_measure(phase, 1);
+	emit_pendings();
+}
+
+/* get the lowest free file descriptor */
+static int fd_probe()
+{
+	int fd = open("/dev/null", O_RDONLY|O_CLOEXEC);
+
+	if (fd >= 0)
+		close(fd);
+	return fd;
+}
+
+/* set busy polling on the sockets opened from the descriptor first */
+static void busy_poll_sockets(int first)
+{
+	int fd, usec = BUSY_POLL_USEC;
+	struct stat st;
+
+	/* libafbcli doesn't expose its socket, the new ones are searched */
+	for (fd = first ; first >= 0 && fd < first + 16 ; fd++)
+		if (fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode)
+		 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof usec) == 0)
+			busypoll_sockets++;
+}
+
+/* measure the cost of reading the clock and of an empty loop iteration */
+static void floor_measure()
+{
+	uint64_t samples[FLOOR_SAMPLES], start;
+	unsigned idx;
+
+	for (idx = 0 ; idx < FLOOR_SAMPLES ; idx++) {
+		start = now_ns();
+		samples[idx] = now_ns() - start;
+	}
+	floor_clock[1] = latency_median(samples, FLOOR_SAMPLES);
+	floor_clock[0] = samples[0];
+
+	for (idx = 0 ; idx < FLOOR_SAMPLES ; idx++) {
+		start = now_ns();
+		sd_event_run(loop, 0);
+		samples[idx] = now_ns() - start;
+	}
+	floor_loop[1] = latency_median(samples, FLOOR_SAMPLES);
+	floor_loop[0] = samples[0];
+	floor_measured = 1;
+}
+
+/* record the duration of a phase of the connection setup */
+static void setup_record(int phase, uint64_t start, uint64_t stop)
+{
+	static const char *names[Setup_Count] = {
+		"setup:connect", "setup:first-reply", "churn:cycle"
+	};
+
+	if (!dostats)
+		return;
+	if (!setup_stats[phase])
+		setup_stats[phase] = stats_get(names[phase]);
+	setup_stats[phase]->sent++;
+	stats_add(setup_stats[phase], stop - start, 0);
+}
+
+/* closes the connection of the current churn cycle */
+static void churn_close()
+{
+	churn_closing = 1;
+	if (pws)
+		afb_proto_ws_unref(pws);
+	if (wsj1)
+		afb_wsj1_unref(wsj1);
+	pws = NULL;
+	wsj1 = NULL;
+	churn_closing = 0;
+}
+
+/* emits the next call of the churn cycle or terminates the cycle */
+static void churn_next()
+{
+	static int emitting = 0;
+	int rc;
+
+	/* failed calls also decrement the count of calls */
+	if (emitting)
+		return;
+	while (churn_calls_left) {
+		churn_calls_left--;
+		emitting = 1;
+		if (direct)
+			rc = pws_call(churn_args[2], churn_object, NULL, NULL);
+		else
+			rc = wsj1_emit(churn_args[2], churn_args[3], churn_object, NULL, NULL);
+		emitting = 0;
+		if (rc >= 0 && callcount)
+			return;
+	}
+	setup_connected = 0;
+	setup_record(Setup_Cycle, churn_start, now_ns());
+	churn_schedule(churn_origin + (churnrate > 0 ? (uint64_t)(churn_started * 1e9 / churnrate) : 0));
+}
+
+/* starts a churn cycle at its time */
+static int on_churn_timer(sd_event_source *src, uint64_t usec, void *closure)
+{
+	sd_event_source_unref(src);
+	churn_timer = NULL;
+	churn_close();
+	if (interrupted || churn_started >= churncount) {
+		churning = 0;
+		return 0;
+	}
+	churn_started++;
+	churn_start = now_ns();
+	if (direct ? connect_pws(churn_args[1], NULL) : connect_wsj1(churn_args[1], NULL)) {
+		churn_failed++;
+		churn_calls_left = 0;
+	}
+	else
+		churn_calls_left = churncalls;
+	churn_next();
+	return 0;
+}
+
+/* schedules the next churn cycle to start not before start */
+static void churn_schedule(uint64_t start)
+{
+	if (sd_event_add_time(loop, &churn_timer, CLOCK_MONOTONIC, start / 1000, 0, on_churn_timer, NULL) < 0)
+		fatal();
+}
+
+/* hash of api/verb */
+static unsigned responder_hash(const char *api, const char *verb)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*api)
+		hash = (hash ^ (unsigned char)*api++) * 16777619u;
+	hash = (hash ^ '/') * 16777619u;
+	while (*verb)
+		hash = (hash ^ (unsigned char)*verb++) * 16777619u;
+	return hash;
+}
+
+/* search the response for api/verb, api/ * or * */
+static struct response *responder_search(const char *api, const char *verb)
+{
+	struct response *response;
+
+	if (responses) {
+		for (response = responses[responder_hash(api, verb) & responses_mask] ; response ; response = response->next)
+			if (!strcmp(response->verb, verb) && !strcmp(response->api, api))
+				return response;
+		for (response = responses[responder_hash(api, "*") & responses_mask] ; response ; response = response->next)
+			if (response->verb[0] == '*' && !response->verb[1] && !strcmp(response->api, api))
+				return response;
+	}
+	return response_default;
+}
+
+/* appends a part to the template of response */
+static void responder_add_part(struct response *response, enum part_kind kind, const char *text, size_t length)
+{
+	struct part *parts = realloc(response->parts, (response->nparts + 1) * sizeof *parts);
+
+	ensure_allocation(parts);
+	parts[response->nparts].kind = kind;
+	parts[response->nparts].text = text;
+	parts[response->nparts++].length = length;
+	response->parts = parts;
+}
+
+/* splits the body of response in parts if it is a template */
+static void responder_template(struct response *response)
+{
+	const char *text = response->body, *var = text;
+	enum part_kind kind;
+	size_t length;
+
+	while ((var = strstr(var, "${"))) {
+		if (!strncmp(var, "${api}", 6)) {
+			kind = Part_Api;
+			length = 6;
+		}
+		else if (!strncmp(var, "${verb}", 7)) {
+			kind = Part_Verb;
+			length = 7;
+		}
+		else if (!strncmp(var, "${args}", 7)) {
+			kind = Part_Args;
+			length = 7;
+		}
+		else {
+			var += 2;
+			continue;
+		}
+		if (var != text)
+			responder_add_part(response, Part_Text, text, (size_t)(var - text));
+		responder_add_part(response, kind, NULL, 0);
+		text = var = var + length;
+	}
+	if (response->nparts && *text)
+		responder_add_part(response, Part_Text, text, strlen(text));
+}
+
+/* sends the response to the call msg */
+static void responder_reply(struct response *response, const char *api, const char *verb, struct afb_wsj1_msg *msg)
+{
+	static char *buffer;
+	static size_t size;
+	const char *object = response->body, *text;
+	size_t length, needed, pos = 0;
+	unsigned idx;
+	char *nbuf;
+	int rc;
+
+	/* instanciate the template */
+	if (response->nparts) {
+		for (idx = 0 ; idx < response->nparts ; idx++) {
+			switch (response->parts[idx].kind) {
+			case Part_Api: text = api; length = strlen(api); break;
+			case Part_Verb: text = verb; length = strlen(verb); break;
+			case Part_Args: text = afb_wsj1_msg_object_s(msg, &length); break;
+			default: text = response->parts[idx].text; length = response->parts[idx].length; break;
+			}
+			needed = pos + length + 1;
+			if (needed > size) {
+				nbuf = realloc(buffer, needed * 2);
+				ensure_allocation(nbuf);
+				buffer = nbuf;
+				size = needed * 2;
+			}
+			memcpy(&buffer[pos], text, length);
+			pos += length;
+		}
+		buffer[pos] = 0;
+		object = buffer;
+	}
+
+	rc = afb_wsj1_reply_s(msg, object, NULL, response->iserror);
+	if (rc < 0)
+		error("replying failed: %m\n");
+	responder_replies++;
+}
+
+/* sends a delayed response */
+static int on_responder_timer(sd_event_source *src, uint64_t usec, void *closure)
 {
-	int r;
-	va_list ap;
-	va_start(ap, fmt);
-	r = out(2, fmt, ap);
-	va_end(ap);
-	return r;
+	struct delayed *delayed = closure;
+
+	sd_event_source_unref(src);
+	responder_reply(delayed->response, delayed->api, delayed->verb, delayed->msg);
+	afb_wsj1_msg_unref(delayed->msg);
+	free(delayed);
+	return 0;
 }
 
-/* add a pending line */
-static void pendings_add(char *line)
+/* answers the call of api/verb if a response exists, returns 0 if not */
+static int responder_answer(const char *api, const char *verb, struct afb_wsj1_msg *msg)
 {
-	struct pending *pending = malloc(sizeof *pending);
-	ensure_allocation(pending);
-	pending->line = line;
-	pending->next = 0;
-	*(!pendings_head ? &pendings_head : &pendings_tail->next) = pending;
-	pendings_tail = pending;
+	struct response *response = responder_search(api, verb);
+	struct delayed *delayed;
+	uint64_t usec;
+
+	if (response == NULL)
+		return 0;
+	if (!response->delay)
+		responder_reply(response, api, verb, msg);
+	else {
+		delayed = malloc(sizeof *delayed + strlen(api) + strlen(verb) + 2);
+		ensure_allocation(delayed);
+		delayed->verb = stpcpy(delayed->api, api) + 1;
+		strcpy(delayed->verb, verb);
+		delayed->response = response;
+		delayed->msg = msg;
+		afb_wsj1_msg_addref(msg);
+		sd_event_now(loop, CLOCK_MONOTONIC, &usec);
+		if (sd_event_add_time(loop, NULL, CLOCK_MONOTONIC, usec + response->delay, 0, on_responder_timer, delayed) < 0)
+			fatal();
+	}
+	return 1;
 }
 
-/* get a pending line */
-static char *pendings_get()
+/* load the table of responses of the file of path */
+static void responder_load(const char *path)
 {
-	struct pending *pending = pendings_head;
-	char *result = pending->line;
-	pendings_head = pending->next;
-	free(pending);
-	return result;
+	FILE *file;
+	char *line = NULL, *head, *pattern, *status, *rem, *slash;
+	size_t size = 0;
+	ssize_t len;
+	unsigned lino = 0, count = 0, idx;
+	struct response *response, *list = NULL;
+	enum json_tokener_error jerr;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		error("can't open responder file %s: %m\n", path);
+		exit(Exit_Bad_Arg);
+	}
+	while ((len = getline(&line, &size, file)) >= 0) {
+		lino++;
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = 0;
+		head = &line[strspn(line, sep)];
+		if (!*head || *head == '#')
+			continue;
+
+		/* PATTERN STATUS [DELAY] BODY */
+		pattern = head;
+		status = &pattern[strcspn(pattern, sep)];
+		if (*status)
+			*status++ = 0;
+		status = &status[strspn(status, sep)];
+		rem = &status[strcspn(status, sep)];
+		if (*rem)
+			*rem++ = 0;
+		rem = &rem[strspn(rem, sep)];
+
+		response = calloc(1, sizeof *response);
+		ensure_allocation(response);
+		if (!strcmp(status, "error"))
+			response->iserror = 1;
+		else if (strcmp(status, "ok")) {
+			error("%s:%u: bad status %s, expected ok or error\n", path, lino, status);
+			exit(Exit_Bad_Arg);
+		}
+		if (*rem >= '0' && *rem <= '9') {
+			status = rem;
+			rem = &rem[strcspn(rem, sep)];
+			if (*rem)
+				*rem++ = 0;
+			rem = &rem[strspn(rem, sep)];
+			if (parse_duration(status, &response->delay)) {
+				error("%s:%u: bad delay %s\n", path, lino, status);
+				exit(Exit_Bad_Arg);
+			}
+		}
+		response->body = strdup(*rem ? rem : "null");
+		ensure_allocation(response->body);
+		responder_template(response);
+		if (!response->nparts) {
+			/* bodies are sent raw, check them now */
+			json_object_put(json_tokener_parse_verbose(response->body, &jerr));
+			if (jerr != json_tokener_success) {
+				error("%s:%u: bad JSON body: %s\n", path, lino, json_tokener_error_desc(jerr));
+				exit(Exit_Bad_Arg);
+			}
+		}
+
+		if (pattern[0] == '*' && !pattern[1]) {
+			response->api = response->verb = "*";
+			response_default = response;
+			continue;
+		}
+		slash = strchr(pattern, '/');
+		if (slash == NULL || slash == pattern || !slash[1]) {
+			error("%s:%u: bad pattern %s, expected api/verb, api/* or *\n", path, lino, pattern);
+			exit(Exit_Bad_Arg);
+		}
+		*slash = 0;
+		response->api = strdup(pattern);
+		response->verb = strdup(&slash[1]);
+		ensure_allocation(response->api);
+		ensure_allocation(response->verb);
+		response->next = list;
+		list = response;
+		count++;
+	}
+	free(line);
+	fclose(file);
+
+	/* build the hash table */
+	if (count) {
+		for (responses_mask = 1 ; responses_mask < 2 * count ; responses_mask <<= 1);
+		responses = calloc(responses_mask, sizeof *responses);
+		ensure_allocation(responses);
+		responses_mask--;
+		while ((response = list)) {
+			list = response->next;
+			idx = responder_hash(response->api, response->verb) & responses_mask;
+			response->next = responses[idx];
+			responses[idx] = response;
+		}
+	}
 }
 
-/* decrement the count of calls */
-static void dec_callcount()
+/* release a reference to the producer */
+static void producer_unref(struct producer *producer)
 {
-	char *line;
+	struct buffer *buffer;
 
-	callcount--;
-	while (synchro && callcount < synchro && pendings_head) {
-		line = pendings_get();
-		emit_line(line);
+	if (--producer->refcount) {
+		/* a client that ended its input leaves when served */
+		if (producer->refcount == 1 && producer->eof && producer->fd >= 0 && !producer->head)
+			producer_close(producer);
+		return;
+	}
+	while ((buffer = producer->head)) {
+		producer->head = buffer->next;
+		free(buffer->value);
+		free(buffer);
+	}
+	free(producer->input);
+	free(producer);
+}
+
+/* disconnect the producer */
+static void producer_close(struct producer *producer)
+{
+	struct producer **prv = &producers;
+
+	while (*prv != producer)
+		prv = &(*prv)->next;
+	*prv = producer->next;
+	sd_event_source_unref(producer->src);
+	close(producer->fd);
+	producer->fd = -1;
+	producer_unref(producer);
+}
+
+/* write the buffered output of the producer */
+static void producer_flush(struct producer *producer)
+{
+	ssize_t rc;
+	struct buffer *buffer;
+
+	while ((buffer = producer->head)) {
+		/* no SIGPIPE when the client left before its replies */
+		rc = send(producer->fd, &buffer->value[buffer->offset], buffer->length - buffer->offset, MSG_NOSIGNAL);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				producer_close(producer);
+			break;
+		}
+		producer->buffered -= (size_t)rc;
+		buffer->offset += (size_t)rc;
+		if (buffer->offset == buffer->length) {
+			producer->head = buffer->next;
+			free(buffer->value);
+			free(buffer);
+		}
+	}
+}
+
+/* discard the oldest buffered output of the producer until it fits the maximum */
+static void producer_drop_oldest(struct producer *producer)
+{
+	struct buffer *buffer, **prv;
+
+	/* the head buffer is kept when partly written */
+	prv = producer->head && producer->head->offset ? &producer->head->next : &producer->head;
+	while ((buffer = *prv) && producer->buffered > out_max) {
+		*prv = buffer->next;
+		if (producer->tail == buffer)
+			producer->tail = prv == &producer->head ? NULL : producer->head;
+		producer->buffered -= buffer->length;
+		dropped_bytes += buffer->length;
+		free(buffer->value);
+		free(buffer);
+	}
+}
+
+/* set the events to watch for the producer */
+static void producer_events(struct producer *producer)
+{
+	uint32_t events = 0;
+
+	/* a producer is not read while its output exceeds the maximum */
+	if (!producer->eof && (!synchro || callcount < synchro) && (!out_max || producer->buffered <= out_max))
+		events |= EPOLLIN;
+	if (producer->head)
+		events |= EPOLLOUT;
+	sd_event_source_set_io_events(producer->src, events);
+}
+
+/* update the events watched for the producers, after a change of the window */
+static void producers_events()
+{
+	struct producer *producer;
+
+	for (producer = producers ; producer ; producer = producer->next)
+		producer_events(producer);
+}
+
+/* output to the producer */
+static int producer_out(struct producer *producer, const char *fmt, va_list ap)
+{
+	int rc;
+	struct buffer *buffer;
+
+	if (producer->fd < 0)
+		return 0; /* disconnected */
+	buffer = malloc(sizeof *buffer);
+	ensure_allocation(buffer);
+	allocs[Alloc_Output] += 2;
+	rc = vasprintf(&buffer->value, fmt, ap);
+	if (rc < 0)
+		oom();
+	if (rc == 0) {
+		free(buffer);
+		return 0;
+	}
+	buffer->length = (unsigned)rc;
+	buffer->offset = 0;
+	buffer->next = 0;
+	buffer->file = producer->fd;
+	*(!producer->head ? &producer->head : &producer->tail->next) = buffer;
+	producer->tail = buffer;
+	producer->buffered += buffer->length;
+	producer_flush(producer);
+	if (producer->fd >= 0 && out_max && producer->buffered > out_max && out_policy == Policy_Drop_Oldest)
+		producer_drop_oldest(producer);
+	if (producer->fd >= 0 && producer->head)
+		producer_events(producer);
+	return 0;
+}
+
+/* process a line received from the producer */
+static void producer_line(struct producer *producer, char *line)
+{
+	char *head = &line[strspn(line, sep)];
+
+	if (!*head || *head == '#')
 		free(line);
+	else if (synchro && callcount >= synchro)
+		pendings_add(line, producer);
+	else {
+		producer->refcount++;
+		print_to = producer;
+		emit_line(line, producer);
+		print_to = NULL;
+		free(line);
+		producer_unref(producer);
 	}
+}
 
-	if (synchro && callcount < synchro && evsrc)
-		sd_event_source_set_io_events(evsrc, EPOLLIN);
+/* read and process the input of the producer */
+static void producer_read(struct producer *producer, int fd)
+{
+	ssize_t rc;
+	size_t pos;
+	char *nl, *line;
+
+	if (producer->eof) {
+		/* the client left entirely, its replies can't be sent */
+		producer_close(producer);
+		return;
+	}
+
+	/* read available data */
+	if (producer->size - producer->length < 4096) {
+		producer->size = producer->size ? 2 * producer->size : 16384;
+		producer->input = realloc(producer->input, producer->size);
+		ensure_allocation(producer->input);
+		allocs[Alloc_Input]++;
+	}
+	rc = read(fd, &producer->input[producer->length], producer->size - producer->length - 1);
+	if (rc < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			producer_close(producer);
+		return;
+	}
+	if (rc == 0) {
+		/* end of input, the last line may lack its newline */
+		producer->eof = 1;
+		if (producer->length)
+			producer->input[producer->length++] = '\n';
+		producer_events(producer);
+	}
+	input_bytes += (uint64_t)rc;
+	producer->length += (size_t)rc;
+
+	/* process the received lines */
+	pos = 0;
+	while (producer->fd >= 0
+	    && (nl = memchr(&producer->input[pos], '\n', producer->length - pos))) {
+		*nl = 0;
+		line = strdup(&producer->input[pos]);
+		allocs[Alloc_Input]++;
+		ensure_allocation(line);
+		pos = (size_t)(nl - producer->input) + 1;
+		producer_line(producer, line);
+	}
+	if (pos) {
+		producer->length -= pos;
+		memmove(producer->input, &producer->input[pos], producer->length);
+	}
 }
 
-/* increment the count of calls */
-static void inc_callcount()
+/* called when something happens on the connection of a producer */
+static int on_producer(sd_event_source *src, int fd, uint32_t revents, void *closure)
 {
-	callcount++;
-	if (synchro && callcount >= synchro && evsrc)
-		sd_event_source_set_io_events(evsrc, 0);
+	struct producer *producer = closure;
+
+	/* the flush or the read may close the producer */
+	producer->refcount++;
+	if (revents & EPOLLOUT) {
+		producer_flush(producer);
+		if (producer->fd >= 0)
+			producer_events(producer);
+	}
+	if (producer->fd >= 0 && (revents & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+		producer_read(producer, fd);
+	producer_unref(producer);
+	return 0;
+}
+
+/* called when a local client connects */
+static int on_listen(sd_event_source *src, int fd, uint32_t revents, void *closure)
+{
+	int cfd;
+	struct producer *producer;
+
+	cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (cfd < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			error("accept failed: %m\n");
+		return 0;
+	}
+	producer = calloc(1, sizeof *producer);
+	ensure_allocation(producer);
+	producer->fd = cfd;
+	producer->refcount = 1;
+	if (sd_event_add_io(loop, &producer->src, cfd, EPOLLIN, on_producer, producer) < 0) {
+		close(cfd);
+		free(producer);
+		return 0;
+	}
+	producer->next = producers;
+	producers = producer;
+	producer_events(producer);
+	return 0;
+}
+
+/* remove the socket file at exit */
+static void listen_exit()
+{
+	if (listen_path)
+		unlink(listen_path);
+}
+
+/* listen for local clients on spec (unix:PATH or unix:@NAME) */
+static void listen_start(const char *spec)
+{
+	int fd;
+	socklen_t length;
+	struct sockaddr_un addr;
+	struct stat st;
+	const char *path;
+
+	if (strncmp(spec, "unix:", 5) || !spec[5] || strlen(&spec[5]) >= sizeof addr.sun_path) {
+		error("bad listen specification %s, expected unix:PATH or unix:@NAME\n", spec);
+		exit(Exit_Bad_Arg);
+	}
+	path = &spec[5];
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	length = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + strlen(path));
+	if (path[0] == '@')
+		addr.sun_path[0] = 0; /* abstract socket */
+	else {
+		/* remove a stale socket but nothing else */
+		if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+			unlink(path);
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0
+	 || bind(fd, (struct sockaddr*)&addr, length) < 0
+	 || listen(fd, SOMAXCONN) < 0) {
+		error("can't listen on %s: %m\n", spec);
+		exit(Exit_Cant_Connect);
+	}
+	if (path[0] != '@') {
+		listen_path = (char*)path;
+		atexit(listen_exit);
+	}
+	if (sd_event_add_io(loop, NULL, fd, EPOLLIN, on_listen, NULL) < 0)
+		fatal();
+	listening = 1;
+	catch_signals();
 }
 
 /* called when wsj1 hangsup */
 static void on_wsj1_hangup(void *closure, struct afb_wsj1 *wsj1)
 {
+	struct endpoint *endpoint = closure;
+
+	if (churn_closing)
+		return;
 	if (!quiet)
-		print("ON-HANGUP\n");
+		print(endpoint ? "ON-HANGUP %s\n" : "ON-HANGUP\n", endpoint ? endpoint->uri : NULL);
 	exit(Exit_HangUp);
 }
 
@@ -624,6 +3882,8 @@ static void on_wsj1_hangup(void *closure, struct afb_wsj1 *wsj1)
 static void on_wsj1_call(void *closure, const char *api, const char *verb, struct afb_wsj1_msg *msg)
 {
 	int rc;
+	if (responder_file && responder_answer(api, verb, msg))
+		return;
 	if (!quiet)
 		print("ON-CALL %s/%s:\n", api, verb);
 	if (raw)
@@ -639,6 +3899,17 @@ static void on_wsj1_call(void *closure, const char *api, const char *verb, struc
 /* called when wsj1 receives an event */
 static void on_wsj1_event(void *closure, const char *event, struct afb_wsj1_msg *msg)
 {
+	struct evcount *evcount = event_counted(event);
+
+	events_received++;
+	if (evcount && evtrack)
+		event_track_text(evcount, afb_wsj1_msg_object_s(msg, 0));
+	if (top) {
+		top_suppressed++;
+		return;
+	}
+	if (out_drop_event())
+		return;
 	if (!quiet)
 		print("ON-EVENT %s:\n", event);
 	if (raw)
@@ -651,72 +3922,113 @@ static void on_wsj1_event(void *closure, const char *event, struct afb_wsj1_msg
 /* called when wsj1 receives a reply */
 static void on_wsj1_reply(void *closure, struct afb_wsj1_msg *msg)
 {
+	uint64_t stop = now_ns();
+	struct request *request = closure;
 	int iserror = !afb_wsj1_msg_is_reply_ok(msg);
 	exitcode = iserror ? Exit_Error : Exit_Success;
-	if (!quiet)
-		print("ON-REPLY %s: %s\n", (char*)closure, iserror ? "ERROR" : "OK");
-	if (raw)
-		print("%s\n", afb_wsj1_msg_object_s(msg, 0));
-	else
-		print("%s\n", json_object_to_json_string_ext(afb_wsj1_msg_object_j(msg),
+	print_to = request->producer;
+	if (top && !print_to)
+		top_suppressed++;
+	else {
+		if (!quiet)
+			print("ON-REPLY %s: %s\n", request->key, iserror ? "ERROR" : "OK");
+		if (raw)
+			print("%s\n", afb_wsj1_msg_object_s(msg, 0));
+		else
+			print("%s\n", json_object_to_json_string_ext(afb_wsj1_msg_object_j(msg),
 							JSON_C_TO_STRING_PRETTY|JSON_C_TO_STRING_NOSLASHESCAPE));
-	free(closure);
-	dec_callcount();
+	}
+	print_to = NULL;
+	request_done(request, iserror, stop);
 }
 
 /* makes a call */
-static void wsj1_call(const char *api, const char *verb, const char *object)
+static int wsj1_call(const char *api, const char *verb, const char *object, struct runner *runner, struct producer *producer)
 {
 	static int num = 0;
-	char *key;
+	char *name, *key;
+	struct stats *stats = NULL;
+	struct request *requests[nendpoints ?: 1];
+	unsigned idx, count, sent;
 	int rc;
 
+	/* get the statistics of the request */
+	if (runner)
+		stats = runner->step->stats;
+	else if (compare_stats)
+		stats = compare_stats;
+	else if (dostats) {
+		rc = asprintf(&name, "%s/%s", api, verb);
+		if (rc < 0)
+			oom();
+		allocs[Alloc_Key]++;
+		stats = stats_get(name);
+		free(name);
+	}
+
 	/* allocates an id for the request */
-	rc = asprintf(&key, "%d:%s/%s", ++num, api, verb);
+	rc = asprintf(&key, "%d:%s/%s", producer ? ++producer->num : ++num, api, verb);
+	if (rc < 0)
+		oom();
+	allocs[Alloc_Key]++;
+	count = requests_create(stats, runner, producer, key, requests);
+	free(key);
 
 	/* echo the command if asked */
 	if (echo)
 		print("SEND-CALL %s/%s %s\n", api, verb, object?:"null");
 
-	/* send the request */
-	inc_callcount();
-	rc = afb_wsj1_call_s(wsj1, api, verb, object, on_wsj1_reply, key);
-	if (rc < 0) {
-		error("calling %s/%s(%s) failed: %m\n", api, verb, object);
-		dec_callcount();
+	/* send the requests */
+	for (idx = sent = 0 ; idx < count ; idx++) {
+		rc = afb_wsj1_call_s(requests[idx]->endpoint ? requests[idx]->endpoint->wsj1 : wsj1,
+					api, verb, object, on_wsj1_reply, requests[idx]);
+		if (rc >= 0)
+			sent++;
+		else {
+			error("calling %s/%s(%s) failed: %m\n", api, verb, object);
+			request_abort(requests[idx]);
+		}
 	}
+	return sent ? 0 : -1;
 }
 
 /* sends an event */
-static void wsj1_event(const char *event, const char *object)
+static int wsj1_event(const char *event, const char *object)
 {
-	int rc;
+	int rc = 0;
+	unsigned idx;
 
 	/* echo the command if asked */
 	if (echo)
 		print("SEND-EVENT: %s %s\n", event, object?:"null");
 
-	rc = afb_wsj1_send_event_s(wsj1, event, object);
+	if (fanout == Fanout_None)
+		rc = afb_wsj1_send_event_s(wsj1, event, object);
+	else if (fanout == Fanout_Shard)
+		rc = afb_wsj1_send_event_s(endpoint_next(NULL)->wsj1, event, object);
+	else
+		for (idx = 0 ; idx < nendpoints ; idx++)
+			if (afb_wsj1_send_event_s(endpoints[idx].wsj1, event, object) < 0)
+				rc = -1;
 	if (rc < 0)
 		error("sending !%s(%s) failed: %m\n", event, object);
+	return rc;
 }
 
 /* emits either a call (when api!='!') or an event */
-static void wsj1_emit(const char *api, const char *verb, const char *object)
+static int wsj1_emit(const char *api, const char *verb, const char *object, struct runner *runner, struct producer *producer)
 {
 	if (object == NULL || object[0] == 0)
 		object = "null";
 
 	if (api[0] == '!' && api[1] == 0)
-		wsj1_event(verb, object);
+		return wsj1_event(verb, object);
 	else
-		wsj1_call(api, verb, object);
+		return wsj1_call(api, verb, object, runner, producer);
 }
 
-static char sep[] = " \t";
-
 /* emit call for the line */
-static void emit_line(char *line)
+static void emit_line(char *line, struct producer *producer)
 {
 	size_t x;
 	char *f1, *f2, *rem;
@@ -729,7 +4041,10 @@ static void emit_line(char *line)
 
 	/* check if system exec requested */
 	if (f1[0] == '!' && x > 1) {
-		system(&f1[1]);
+		if (producer)
+			error("system commands are not allowed: %s\n", line);
+		else
+			system(&f1[1]);
 		return;
 	}
 	f2 = &f1[x];
@@ -738,13 +4053,13 @@ static void emit_line(char *line)
 	f2 = &f2[strspn(f2, sep)];
 
 	if (direct)
-		pws_call(f1, f2);
+		pws_call(f1, f2, NULL, producer);
 	else if (f2[0]) {
 		rem = &f2[strcspn(f2, sep)];
 		if (*rem)
 			*rem++ = 0;
 		rem = &rem[strspn(rem, sep)];
-		wsj1_emit(f1, f2, rem);
+		wsj1_emit(f1, f2, rem, NULL, producer);
 	}
 	else
 		error("verb missing, bad line: %s\n", line);
@@ -771,73 +4086,77 @@ static void process_line(char *line)
 	head = &line[strspn(line, sep)];
 	if (*head && *head != '#') {
 		if (synchro && callcount >= synchro) {
-			pendings_add(line);
+			pendings_add(line, NULL);
 			return;
 		}
-		emit_line(line);
+		emit_line(line, NULL);
 	}
 	free(line);
 }
 
-/* process stdin */
-static void process_stdin()
+/* process the result rc of reading stdin in the input buffer */
+static void process_input(ssize_t rc)
 {
-	static size_t pos = 0;
-	static size_t count = 0;
-	static char   line[16384];
-	static char  *prvline = NULL;
-	static size_t prvsize = 0;
-
-	ssize_t rc = 0;
 	char *l;
 
-	/* read the buffer */
-	while (sizeof line > count) {
-		rc = read(0, line + count, sizeof line - count);
-		if (rc >= 0 || errno != EINTR)
-			break;
-	}
 	if (rc < 0) {
 		if (errno != EAGAIN) {
 			error("read error: %m\n");
 			exit(Exit_Input_Fail);
 		}
 	}
-	else {
-		count += (size_t)rc;
-	}
-	while (pos < count) {
-		if (line[pos] != '\n') {
-			pos++;
-			if (pos >= sizeof line) {
-				l = realloc(prvline, prvsize + pos);
+	else
+		incount += (size_t)rc;
+	while (inpos < incount) {
+		if (inbuf[inpos] != '\n') {
+			inpos++;
+			if (inpos >= sizeof inbuf) {
+				l = realloc(inprvline, inprvsize + inpos);
 				ensure_allocation(l);
-				memcpy(&l[prvsize], line, pos);
-				prvsize += pos;
-				prvline = l;
-				count -= pos;
-				pos = 0;
+				allocs[Alloc_Input]++;
+				memcpy(&l[inprvsize], inbuf, inpos);
+				inprvsize += inpos;
+				inprvline = l;
+				incount -= inpos;
+				inpos = 0;
 			}
 		}
-		else if (pos > 0) {
-			l = realloc(prvline, prvsize + pos + 1);
+		else if (inpos > 0) {
+			l = realloc(inprvline, inprvsize + inpos + 1);
 			ensure_allocation(l);
-			memcpy(&l[prvsize], line, pos);
-			l[prvsize + pos] = 0;
-			if (++pos < count)
-				memmove(line, line + pos, count - pos);
-			count -= pos;
-			pos = 0;
-			prvsize = 0;
-			prvline = NULL;
+			allocs[Alloc_Input]++;
+			memcpy(&l[inprvsize], inbuf, inpos);
+			l[inprvsize + inpos] = 0;
+			if (++inpos < incount)
+				memmove(inbuf, inbuf + inpos, incount - inpos);
+			incount -= inpos;
+			inpos = 0;
+			inprvsize = 0;
+			inprvline = NULL;
 			process_line(l);
 		}
 	}
-	if (rc == 0 && count == 0) {
+	if (rc == 0 && incount == 0) {
 		process_line(0);
 	}
 }
 
+/* process stdin */
+static void process_stdin()
+{
+	ssize_t rc = 0;
+
+	/* read the buffer */
+	while (sizeof inbuf > incount) {
+		rc = read(0, inbuf + incount, sizeof inbuf - incount);
+		if (rc >= 0 || errno != EINTR)
+			break;
+	}
+	if (rc > 0)
+		input_bytes += (uint64_t)rc;
+	process_input(rc);
+}
+
 /* called when something happens on stdin */
 static int on_stdin(sd_event_source *src, int fd, uint32_t revents, void *closure)
 {
@@ -859,21 +4178,31 @@ static int on_stdin(sd_event_source *src, int fd, uint32_t revents, void *closur
 
 static void on_pws_reply(void *closure, void *request, struct json_object *result, const char *error, const char *info)
 {
+	uint64_t stop = now_ns();
 	int iserror = !!error;
 	exitcode = iserror ? Exit_Error : Exit_Success;
 	error = error ?: "success";
-	if (!quiet)
-		print("ON-REPLY %s: %s %s\n", (char*)request, error, info ?: "");
-	if (raw)
-		print("%s\n", json_object_to_json_string_ext(result, JSON_C_TO_STRING_NOSLASHESCAPE));
-	else
-		print("%s\n", json_object_to_json_string_ext(result, JSON_C_TO_STRING_PRETTY|JSON_C_TO_STRING_NOSLASHESCAPE));
-	free(request);
-	dec_callcount();
+	print_to = ((struct request*)request)->producer;
+	if (top && !print_to)
+		top_suppressed++;
+	else {
+		if (!quiet)
+			print("ON-REPLY %s: %s %s\n", ((struct request*)request)->key, error, info ?: "");
+		if (raw)
+			print("%s\n", json_object_to_json_string_ext(result, JSON_C_TO_STRING_NOSLASHESCAPE));
+		else
+			print("%s\n", json_object_to_json_string_ext(result, JSON_C_TO_STRING_PRETTY|JSON_C_TO_STRING_NOSLASHESCAPE));
+	}
+	print_to = NULL;
+	request_done(request, iserror, stop);
 }
 
 static void on_pws_event_create(void *closure, uint16_t event_id, const char *event_name)
 {
+	struct evcount **ids = event_ids(closure);
+
+	if (ids)
+		ids[event_id] = evcount_get(event_name);
 	if (!quiet)
 		print("ON-EVENT-CREATE: [%d:%s]\n", event_id, event_name);
 }
@@ -887,17 +4216,28 @@ static void on_pws_event_remove(void *closure, uint16_t event_id)
 static void on_pws_event_subscribe(void *closure, void *request, uint16_t event_id)
 {
 	if (!quiet)
-		print("ON-EVENT-SUBSCRIBE %s: [%d]\n", (char*)request, event_id);
+		print("ON-EVENT-SUBSCRIBE %s: [%d]\n", ((struct request*)request)->key, event_id);
 }
 
 static void on_pws_event_unsubscribe(void *closure, void *request, uint16_t event_id)
 {
 	if (!quiet)
-		print("ON-EVENT-UNSUBSCRIBE %s: [%d]\n", (char*)request, event_id);
+		print("ON-EVENT-UNSUBSCRIBE %s: [%d]\n", ((struct request*)request)->key, event_id);
 }
 
 static void on_pws_event_push(void *closure, uint16_t event_id, struct json_object *data)
 {
+	struct evcount *evcount = event_counted_id(closure, event_id);
+
+	events_received++;
+	if (evcount && evtrack)
+		event_track_json(evcount, data);
+	if (top) {
+		top_suppressed++;
+		return;
+	}
+	if (out_drop_event())
+		return;
 	if (!quiet)
 		print("ON-EVENT-PUSH: [%d]\n", event_id);
 	if (raw)
@@ -908,6 +4248,17 @@ static void on_pws_event_push(void *closure, uint16_t event_id, struct json_obje
 
 static void on_pws_event_broadcast(void *closure, const char *event_name, struct json_object *data, const afb_proto_ws_uuid_t uuid, uint8_t hop)
 {
+	struct evcount *evcount = event_counted(event_name);
+
+	events_received++;
+	if (evcount && evtrack)
+		event_track_json(evcount, data);
+	if (top) {
+		top_suppressed++;
+		return;
+	}
+	if (out_drop_event())
+		return;
 	if (!quiet)
 		print("ON-EVENT-BROADCAST: [%s]\n", event_name);
 	if (raw)
@@ -916,24 +4267,115 @@ static void on_pws_event_broadcast(void *closure, const char *event_name, struct
 		print("%s\n", json_object_to_json_string_ext(data, JSON_C_TO_STRING_PRETTY|JSON_C_TO_STRING_NOSLASHESCAPE));
 }
 
+/* create one session and its token on the WSAPI connection */
+static void session_create(const char *sessionstr, const char *tokenstr)
+{
+	uint16_t id = (uint16_t)++nsessions;
+	uint16_t *tokens = realloc(sessions_tokens, nsessions * sizeof *tokens);
+
+	ensure_allocation(tokens);
+	sessions_tokens = tokens;
+	tokens[id - 1] = tokenstr ? id : 0;
+	if (afb_proto_ws_client_session_create(pws, id, sessionstr) < 0
+	 || (tokenstr && afb_proto_ws_client_token_create(pws, id, tokenstr) < 0)) {
+		error("creation of session %s failed: %m\n", sessionstr);
+		exit(Exit_Cant_Connect);
+	}
+}
+
+/* creates the sessions and tokens of the WSAPI connection */
+static void sessions_create()
+{
+	FILE *file;
+	char *line = NULL, *sessionstr, *tokenstr, *name;
+	size_t size = 0;
+	unsigned count = nsessions;
+
+	nsessions = 0;
+	if (!sessions_file) {
+		/* sessions are UUID-1 ... UUID-N */
+		while (nsessions < count) {
+			if (asprintf(&name, "%s-%u", uuid ?: "afb-client", nsessions + 1) < 0)
+				oom();
+			session_create(name, token);
+			free(name);
+		}
+		return;
+	}
+
+	/* sessions are the lines UUID [TOKEN] of the file */
+	file = fopen(sessions_file, "r");
+	if (file == NULL) {
+		error("can't open sessions file %s: %m\n", sessions_file);
+		exit(Exit_Bad_Arg);
+	}
+	while ((!count || nsessions < count) && getline(&line, &size, file) >= 0) {
+		sessionstr = &line[strspn(line, sep)];
+		if (!*sessionstr || *sessionstr == '#' || *sessionstr == '\n')
+			continue;
+		tokenstr = &sessionstr[strcspn(sessionstr, " \t\n")];
+		if (*tokenstr)
+			*tokenstr++ = 0;
+		tokenstr = &tokenstr[strspn(tokenstr, sep)];
+		tokenstr[strcspn(tokenstr, " \t\n")] = 0;
+		if (nsessions == UINT16_MAX) {
+			error("too many sessions in %s (maxi is %d)\n", sessions_file, UINT16_MAX);
+			exit(Exit_Bad_Arg);
+		}
+		session_create(sessionstr, *tokenstr ? tokenstr : token);
+	}
+	free(line);
+	count_file_input(file);
+	fclose(file);
+	if (!nsessions) {
+		error("no session in %s\n", sessions_file);
+		exit(Exit_Bad_Arg);
+	}
+}
+
 /* makes a call */
-static void pws_call(const char *verb, const char *object)
+static int pws_call(const char *verb, const char *object, struct runner *runner, struct producer *producer)
 {
 	static int num = 0;
-	char *key;
 	int rc;
+	uint16_t session, tokenid;
 	struct json_object *o;
+	struct stats *stats = NULL;
+	struct request *requests[nendpoints ?: 1];
+	unsigned idx, count, sent;
+	char *key;
 	enum json_tokener_error jerr;
 
+	/* select the session, the one of the runner or the next one */
+	if (runner)
+		session = runner->session;
+	else if (nsessions)
+		session = (uint16_t)(1 + sessions_next++ % nsessions);
+	else
+		session = numuuid;
+	tokenid = nsessions ? sessions_tokens[session - 1] : numtoken;
+
+	/* get the statistics of the request */
+	if (runner)
+		stats = runner->step->stats;
+	else if (compare_stats)
+		stats = compare_stats;
+	else if (dostats)
+		stats = stats_get(verb);
+
 	/* allocates an id for the request */
-	rc = asprintf(&key, "%d:%s", ++num, verb);
+	rc = asprintf(&key, "%d:%s", producer ? ++producer->num : ++num, verb);
+	if (rc < 0)
+		oom();
+	allocs[Alloc_Key]++;
+	count = requests_create(stats, runner, producer, key, requests);
+	free(key);
 
 	/* echo the command if asked */
 	if (echo)
 		print("SEND-CALL: %s %s\n", verb, object?:"null");
 
-	/* send the request */
-	inc_callcount();
+	/* send the requests */
 	if (object == NULL || object[0] == 0)
 		o = NULL;
 	else {
@@ -941,18 +4383,28 @@ static void pws_call(const char *verb, const char *object)
 		if (jerr != json_tokener_success)
 			o = json_object_new_string(object);
 	}
-	rc = afb_proto_ws_client_call(pws, verb, o, numuuid, numtoken, key, NULL);
-	json_object_put(o);
-	if (rc < 0) {
-		error("calling %s(%s) failed: %m\n", verb, object?:"");
-		dec_callcount();
+	for (idx = sent = 0 ; idx < count ; idx++) {
+		rc = afb_proto_ws_client_call(requests[idx]->endpoint ? requests[idx]->endpoint->pws : pws,
+					verb, o, session, tokenid, requests[idx], NULL);
+		if (rc >= 0)
+			sent++;
+		else {
+			error("calling %s(%s) failed: %m\n", verb, object?:"");
+			request_abort(requests[idx]);
+		}
 	}
+	json_object_put(o);
+	return sent ? 0 : -1;
 }
 
 /* called when pws hangsup */
 static void on_pws_hangup(void *closure)
 {
+	struct endpoint *endpoint = closure;
+
+	if (churn_closing)
+		return;
 	if (!quiet)
-		print("ON-HANGUP\n");
+		print(endpoint ? "ON-HANGUP %s\n" : "ON-HANGUP\n", endpoint ? endpoint->uri : NULL);
 	exit(Exit_HangUp);
 }